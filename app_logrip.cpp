@@ -27,11 +27,43 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <regex>
+#include <stdexcept>
 #include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <cmath>
+#include <iterator>
+#include <functional>
 
 #ifdef _WIN32
   #include <conio.h>
+  #include <windows.h>
+  #include <psapi.h>
+  #define fseek64   _fseeki64
+  #define ftell64   _ftelli64
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/resource.h>
+  #ifdef __linux__
+    #include <malloc.h>
+  #endif
+  #define fseek64   fseeko
+  #define ftell64   ftello
+#endif
+
+#ifdef BUILD_ZLIB
+  #include <zlib.h>
+#endif
+#ifdef BUILD_ZSTD
+  #include <zstd.h>
 #endif
 
 #ifdef BUILD_OPENSSL
@@ -76,6 +108,40 @@ int CONF_LOAD_DURATION =  13;
 int CONF_LOAD_SCALE =     14;
 int CONF_VIS_RES =        15;
 int CONF_VIS_ZOOM =       16;
+int CONF_THREADS =        17;
+int CONF_FOLLOW =         18;
+int CONF_FOLLOW_POLL =    19;
+int CONF_SNAPSHOT =       20;
+int CONF_PREFIX_B =       21;
+int CONF_PREFIX_C =       22;
+int CONF_TIGHT_PREFIX =   23;
+int CONF_PREFIX6_B =      24;
+int CONF_PREFIX6_C =      25;
+int CONF_GEO_DB =         26;
+int CONF_LOOKUP =         27;
+int CONF_LOOKUP_HOST =    28;
+int CONF_LOOKUP_RATE =    29;
+int CONF_LOOKUP_CACHE =   30;
+int CONF_BENCH =          31;
+int CONF_GEN_HITS =       32;
+int CONF_GEN_FILE =       33;
+int CONF_GEN_STYLE =      34;
+int CONF_GEN_IPS =        35;
+int CONF_GEN_SUBNETS =    36;
+int CONF_GEN_CRAWLERS =   37;
+int CONF_GEN_DAYS =       38;
+int CONF_GEN_SEED =       39;
+int CONF_REPORT =         40;
+int CONF_TRACE =          41;
+int CONF_BLOCK_NFT =      42;
+int CONF_BLOCK_IPSET =    43;
+int CONF_BLOCK_STATE =    44;
+int CONF_ROLLING =        45;
+int CONF_SKETCH =         46;
+int CONF_SKETCH_TOP =     47;
+int CONF_VIS_DENSITY =    48;
+int CONF_VIS_TILES =      49;
+int CONF_VIS_TILE_SAVE =  50;
 
 
 enum class ValueType {
@@ -129,35 +195,164 @@ struct ConfigEntry {
   Value         val;  
 };
 
+// packed time
+// - seconds since 1970-01-01 in 32-bits, log timestamps have 1 sec resolution
+#define SEC_PER_DAY   86400
+
+inline int    elapsedDays ( uint32_t t, uint32_t base ) { return int( (int64_t(t) - int64_t(base)) / SEC_PER_DAY ); }
+inline float  elapsedMin ( uint32_t t, uint32_t base )  { return float( int64_t(t) - int64_t(base) ) / 60.0f; }
+inline double elapsedSec ( uint32_t t, uint32_t base )  { return double( int64_t(t) - int64_t(base) ); }
+inline uint32_t dayStart ( uint32_t t )                 { return t - (t % SEC_PER_DAY); }
+
 // log entry
+// - compact hit record, page strings are interned in the page table
+// - blocking actions per hit are kept apart, in m_HitBlock, so a hit stays 16 bytes
 struct LogInfo {
-  void clear() {date.Clear(); page=""; ip=0; block=0; }
-  bool isValid() {return (!date.isEmpty() && !page.empty() && ip > 0); }
-  bool operator<(const LogInfo& other) const { return date < other.date; }
-  TimeX         date;
-  std::string   page;
-  uint32_t      ip;
-  char          block;
+  void clear() {time=0; page=0; ip=0; }
+  bool isValid() {return (time >= SEC_PER_DAY && page != 0 && ip > 0); }
+  bool operator<(const LogInfo& other) const { return time < other.time; }
+  uint32_t      time;     // packed timestamp
+  uint32_t      page;     // page id
+  uint64_t      ip;       // ip key, see isIPv6
+};
+
+// page string table
+// - each unique page string is stored once in a character arena
+// - hits refer to pages by 32-bit id, id 0 is the empty page
+class PageTable {
+public:
+  PageTable()                                 { Clear(); }
+  void        Clear ();
+  uint32_t    Intern ( const char* str, int len );
+  void        Merge ( const PageTable& src, std::vector<uint32_t>& remap );
+  void        BuildRanks ();
+  void        Write ( FILE* fp ) const;
+  bool        Read ( const char* data, size_t len );
+
+  uint32_t    Count () const                  { return (uint32_t) m_offs.size(); }
+  const char* getStr ( uint32_t id ) const    { return &m_chars[ m_offs[id] ]; }
+  int         getLen ( uint32_t id ) const    { return m_lens[id]; }
+  uint32_t    getRank ( uint32_t id ) const   { return m_rank[id]; }     // order by name
+  bool        isRobots ( uint32_t id ) const  { return m_robots[id] != 0; }
+
+private:
+  static uint64_t Hash ( const char* str, int len );
+  void        Rehash ( size_t slots );
+
+  std::vector<char>       m_chars;      // string arena, null-terminated strings
+  std::vector<uint64_t>   m_offs;       // id -> arena offset
+  std::vector<int>        m_lens;       // id -> string length
+  std::vector<uint64_t>   m_hashes;     // id -> hash
+  std::vector<char>       m_robots;     // id -> page is robots.txt
+  std::vector<uint32_t>   m_rank;       // id -> rank by name
+  std::vector<uint32_t>   m_slots;      // open-addressing table of ids
 };
 
 
 // subnets
+// - levels are CIDR prefixes, A/B/C/D are /8, /16, /24 and /32 by default
+//   for IPv6 they are /16, /32, /48 and /64. an IPv6 machine is its /64 network
+// - a subnet is keyed by its network address (host bits zero)
 #define SUB_A     0
 #define SUB_B     1
 #define SUB_C     2
 #define SUB_D     3
 #define SUB_MAX   4
+#define SUB_ASN   4     // ASN grouping, kept apart from the subnet levels
+
+int subnet_bits[SUB_MAX] = { 8, 16, 24, 32 };     // prefix length of each level
+int subnet_bits6[SUB_MAX] = { 16, 32, 48, 64 };   // same for IPv6
+
+// firewall sets, same names as block_ips.sh
+#define NFT_TABLE       "filter"
+#define NFT_SET         "blocked_ips"
+#define NFT_SET6        "blocked_ips6"
+#define IPSET_MAXELEM   1048576
+
+// CIDR block
+struct CIDRNet {
+  uint64_t  net;        // network key
+  int       bits;       // prefix length, within the ip family
+};
+
+// unique count sketch (hyperloglog)
+// - 64 registers of 4 bits in 32 bytes, about 13% error
+// - sketches merge by the larger register, so a subnet is the union of its IPs
+#define UNIQ_REGS   64
+
+struct UniqSketch {
+  void      Clear ()                          { reg[0] = reg[1] = reg[2] = reg[3] = 0; }
+  void      Add ( uint32_t key );
+  void      Merge ( const UniqSketch& src );
+  float     Estimate () const;
+  int       getReg ( int i ) const            { return int((reg[i >> 4] >> ((i & 15) * 4)) & 15); }
+
+  uint64_t  reg[4];       // 16 registers per word
+};
+
+// heavy hitters (space-saving)
+// - a fixed number of counters, the smallest is taken over by a new key and its count kept as the error
+// - every key with more than hits/counters hits is kept, with a count high by at most its error
+struct TopCount {
+  uint64_t  key;
+  uint64_t  cnt;
+  uint64_t  err;
+};
+
+class TopK {
+public:
+  void      Init ( int counters );
+  void      Add ( uint64_t key );
+  void      getTop ( int num, std::vector<TopCount>& out ) const;     // highest first
+
+private:
+  void      SiftUp ( int i );
+  void      SiftDown ( int i );
+  void      Swap ( int a, int b );
+
+  int                     m_max;
+  std::vector<TopCount>   m_heap;     // min-heap by count
+  std::unordered_map<uint64_t, int> m_pos;    // key -> heap index
+};
+
+// rolling rates
+// - hit counts decay exponentially, each is about the hits over the last 1, 10, 60 mins and day
+// - fixed size per IP or subnet, updated one hit at a time in time order
+#define RATE_1M     0
+#define RATE_10M    1
+#define RATE_60M    2
+#define RATE_DAY    3
+#define RATE_MAX    4
+
+static const float rate_secs[RATE_MAX] = { 60, 600, 3600, SEC_PER_DAY };
+
+struct RateState {
+  void      Add ( uint32_t t, uint32_t page, bool robots );
+  float     getPPM ( int w ) const    { return cnt[w] * 60.0f / rate_secs[w]; }
+  float     getUniq () const;
+
+  uint64_t  log_end;            // hits of m_Log before this are folded in
+  uint32_t  hits;               // hits folded in
+  uint32_t  last;               // time of the last hit
+  float     cnt[RATE_MAX];      // decayed hit counts
+  float     peak[RATE_MAX];     // highest counts seen
+  int       robots;             // robots.txt hits
+  UniqSketch pages;             // unique pages
+  uint32_t  flag_time;          // first hit over a threshold, 0 = none
+  int       score;              // rolling score, same codes as ComputeScore
+};
 
 // ip info
 struct IPInfo {
   int       lev;
-  uint32_t  ip;
+  uint64_t  ip;
+  int       geo;          // range in the geo database, 0 = none
 
   int    score;           // blocklist score
   char   block;           // blocklist action
 
-  TimeX  start_date;      // start range of access
-  TimeX  end_date;        // end range of access
+  uint32_t start_time;    // start range of access
+  uint32_t end_time;      // end range of access
 
   float  elapsed;         // elapsed time (in mins)
   int    ip_cnt;          // number of ips in subnet
@@ -180,21 +375,417 @@ struct IPInfo {
   float  uniq_ratio;
   float  visit_freq;
   float  visit_time;
-  std::string  lookup[10];
 
-  std::vector<LogInfo>	pages;	
+  size_t first;           // base range of hits in m_Log, from first
+  int    base_cnt;        // hits in the base range (page_cnt, less any hits added in follow mode)
 };
 
 struct DayInfo {
-  DayInfo(TimeX day)		{ date=day; pages.clear(); }
+  DayInfo(TimeX day)		{ date=day; }
   TimeX   date;
   IPInfo  metrics;
   Vec3I   stats;
-  std::vector<LogInfo>  pages;
 };
 
-typedef std::map<uint32_t, IPInfo >             IPMap_t;
-typedef std::map<uint32_t, IPInfo>::iterator    IPMap_iter;
+// memory-mapped input file
+struct MappedFile {
+  MappedFile()    { data = 0x0; size = 0; }
+  ~MappedFile()   { Close(); }
+  bool Open ( std::string filename );
+  void Close ();
+  const char*   data;
+  size_t        size;
+  #ifdef _WIN32
+    HANDLE      hfile, hmap;
+  #endif
+};
+
+// log input stream, plain or compressed
+// - type is found from the first bytes of the file, not the extension
+// - .gz needs BUILD_ZLIB, .zst needs BUILD_ZSTD
+#define LOG_PLAIN   0
+#define LOG_GZIP    1
+#define LOG_ZSTD    2
+
+struct LogStream {
+  LogStream ();
+  ~LogStream()    { Close(); }
+  static int  getType ( std::string filename );
+  bool        Open ( std::string filename );
+  size_t      Read ( char* buf, size_t len );   // uncompressed bytes, 0 at end
+  void        Close ();
+  int         type;
+  FILE*       fp;
+  uint64_t    in_size, in_pos;                  // compressed bytes, total and read
+  #ifdef BUILD_ZLIB
+    gzFile    gz;
+  #endif
+  #ifdef BUILD_ZSTD
+    ZSTD_DStream*     zs;
+    std::vector<char> zbuf;
+    ZSTD_inBuffer     zin;
+    bool              zin_end;
+  #endif
+};
+
+// snapshot file
+// - header, then the hits, the page table and the four IP levels at 64-byte aligned offsets
+// - native record layout. a snapshot is only used if the version and record sizes match
+#define SNAP_VERSION  8
+struct SnapHeader {
+  char      magic[8];         // "LOGRIPSS"
+  uint32_t  version;
+  uint32_t  hit_size;         // sizeof(LogInfo)
+  uint32_t  ip_size;          // sizeof(IPInfo)
+  int32_t   total_days;
+  uint32_t  time_min, time_max;
+  uint64_t  log_pos;          // bytes of the log parsed
+  uint64_t  log_hash;         // hash of the start of the log, to detect a replaced log
+  uint64_t  fmt_hash;         // hash of the format string
+  uint64_t  policy_hash;      // hash of the scoring settings
+  uint64_t  num_hits, base_hits;
+  uint64_t  num_ips[SUB_MAX];
+  uint64_t  off_hits, off_pages, off_ips[SUB_MAX];
+  uint64_t  off_uniq[SUB_MAX];  // page sketches, num_ips per level, sketch mode only
+  uint64_t  off_rate[SUB_MAX];  // rate states, num_ips per level, rolling mode only
+};
+
+// newline-aligned chunk of log input
+// - parsed independently into its own hits
+struct LogChunk {
+  const char*           data;
+  size_t                len;
+  long                  hits, skipped;
+  std::vector<LogInfo>  log;
+  PageTable             pages;
+};
+
+// ingestion progress, across all input blocks
+struct LoadProgress {
+  size_t    total;        // total input bytes
+  long      percl;        // last percentage reported
+  std::atomic<size_t>  done;
+  std::atomic<long>    hits, skipped;
+};
+
+class LogFormat;
+
+// ip lookup results (cold data)
+struct IPLookup {
+  std::string  str[10];   // L_STATUS..L_ASNAME
+};
+
+// ip table, one per subnet level
+// - records are kept in a flat array sorted by (masked) ip, found by binary search
+// - lookup strings are cold, kept aside for the few IPs that have them
+// - page sketches (sketch mode) and rate states (rolling mode) are only kept when used,
+//   aside in arrays in step with the records
+class IPTable {
+public:
+  IPTable ()                                  { m_sketch = false; m_rolling = false; }
+  void        Clear ()                        { m_list.clear(); m_uniq.clear(); m_rate.clear(); m_lookup.clear(); }
+  void        setSketch ( bool on )           { m_sketch = on; m_uniq.resize ( on ? m_list.size() : 0 ); }
+  void        setRolling ( bool on )          { m_rolling = on; m_rate.resize ( on ? m_list.size() : 0 ); }
+  IPInfo&     Insert ( uint64_t ip, bool& created );
+  void        Merge ( std::vector<IPInfo>& add );
+  size_t      LowerBound ( uint64_t ip );     // first record with ip >= given
+  IPInfo*     Find ( uint64_t ip );
+  IPLookup*   getLookup ( uint64_t ip );
+  IPLookup&   setLookup ( uint64_t ip )       { return m_lookup[ip]; }
+
+  size_t      size () const                   { return m_list.size(); }
+  IPInfo&     operator[] ( size_t n )         { return m_list[n]; }
+  std::vector<IPInfo>& getList ()             { return m_list; }
+  UniqSketch& getUniq ( const IPInfo* f )     { return m_uniq[ f - &m_list[0] ]; }
+  std::vector<UniqSketch>& getUniqList ()     { return m_uniq; }
+  RateState&  getRate ( const IPInfo* f )     { return m_rate[ f - &m_list[0] ]; }
+  std::vector<RateState>& getRateList ()      { return m_rate; }
+
+private:
+  std::vector<IPInfo>                     m_list;
+  std::vector<UniqSketch>                 m_uniq;     // page sketch per record, sketch mode only
+  std::vector<RateState>                  m_rate;     // rate state per record, rolling mode only
+  bool                                    m_sketch, m_rolling;
+  std::unordered_map<uint64_t, IPLookup>  m_lookup;
+};
+
+// offline geo database, ranges of ip keys with ASN, org and country
+// - loaded from a CSV/TSV of CIDR rows (network, asn, org) or range rows (start, end, asn, country, org)
+// - ranges are sorted and non-overlapping, so a sorted IP level is annotated in one merge pass
+// - range 0 is 'none'
+class GeoDB {
+public:
+  GeoDB()                                     { Clear(); }
+  void        Clear ();
+  bool        Load ( std::string filename );
+  void        Annotate ( IPTable& list, int lev );
+
+  size_t      size () const                   { return m_ranges.size() - 1; }
+  uint32_t    getASN ( int g ) const          { return m_ranges[g].asn; }
+  const std::string& getOrg ( int g ) const   { return m_strs[ m_ranges[g].org ]; }
+  const std::string& getCountry ( int g ) const { return m_strs[ m_ranges[g].country ]; }
+
+private:
+  struct GeoRange {
+    uint64_t  lo, hi;         // first and last ip key
+    uint32_t  asn;
+    uint32_t  org, country;   // string ids
+  };
+  uint32_t    Intern ( const std::string& str );
+  void        AddRange ( uint64_t lo, uint64_t hi, const std::string& asn, const std::string& org, const std::string& country );
+
+  std::vector<GeoRange>   m_ranges;
+  std::vector<std::string> m_strs;
+  std::unordered_map<std::string, uint32_t> m_strid;
+};
+
+// remote ip lookup, batched, rate limited and cached
+// - batches of up to 100 ips go to the ip-api batch endpoint (POST /batch), on a thread of their own
+// - a token bucket spaces the batches to the endpoint limit, the X-Rl/X-Ttl headers are honored too
+// - results are kept in a cache file between runs, failed lookups included
+// - lookup_host can point to a local server that answers like ip-api
+#define LOOKUP_BATCH        100
+#define LOOKUP_RETRIES      3
+#define LOOKUP_CACHE_DAYS   30
+
+class LookupService {
+public:
+  LookupService()                             { m_rate = 0.25; m_tokens = 1; m_burst = 1; }
+  ~LookupService()                            { Finish(); }
+  void        LoadCache ( std::string filename );
+  void        Start ( std::string host, float per_min, std::vector<uint64_t>& ips );
+  void        Finish ();                      // wait for the lookups, save the cache
+  const IPLookup* Find ( uint64_t ip ) const;
+
+  size_t      numPending () const             { return m_pending.size(); }
+
+private:
+  struct Entry {
+    uint32_t  time;           // when looked up
+    IPLookup  lk;
+  };
+  void        Run ();
+  bool        RequestBatch ( const std::vector<uint64_t>& ips, int& wait );
+  void        TakeToken ();
+  void        SaveCache ();
+
+  std::string             m_host, m_cachefile;
+  std::unordered_map<uint64_t, Entry>  m_cache;
+  std::vector<uint64_t>   m_pending;          // ips to look up
+  std::thread             m_thread;
+  double                  m_rate, m_burst, m_tokens;    // token bucket, batches per second
+  std::chrono::steady_clock::time_point m_last;
+};
+
+// buffered csv output
+// - rows are formatted directly into a large buffer, written out in big batches
+// - numbers and IPs are formatted by hand, matching printf output
+class CSVWriter {
+public:
+  CSVWriter()                                 { m_fp = 0x0; m_len = 0; }
+  ~CSVWriter()                                { Close(); }
+  bool        Open ( std::string filename );
+  void        Close ();
+
+  void        Str ( const char* str, size_t len );
+  void        Str ( const char* str )         { Str ( str, strlen(str) ); }
+  void        Str ( const std::string& str )  { Str ( str.c_str(), str.size() ); }
+  void        Char ( char c )                 { if (m_len == CSV_BUF) Flush(); m_buf[m_len++] = c; }
+  void        Int ( long long v );
+  void        Float ( double v, int prec=6 );   // same as %.<prec>f
+  void        IP ( uint64_t ip, int bits=32, char wild='*' );
+
+private:
+  void        Flush ();
+  enum { CSV_BUF = 1 << 20 };
+
+  FILE*       m_fp;
+  size_t      m_len;
+  std::vector<char> m_buf;
+};
+
+// time-ordered walk over a range of hits
+class HitMerge {
+public:
+  void Start ( const std::vector<LogInfo>& log, size_t first, size_t cnt );
+  bool Next ( size_t& n );
+private:
+  struct Run {
+    Run(size_t s, size_t e)   { pos = s; end = e; }
+    size_t    pos, end;
+  };
+  struct Later {              // heap order, earliest hit on top
+    Later(const LogInfo* l)   { log = l; }
+    bool operator() (const Run& a, const Run& b) const {
+      uint32_t ta = log[a.pos].time, tb = log[b.pos].time;
+      return (ta != tb) ? (ta > tb) : (a.pos > b.pos);
+    }
+    const LogInfo* log;
+  };
+  const LogInfo*      m_log;
+  std::vector<Run>    m_heap;
+};
+
+// time-ordered hit store
+// - a view of all hits in time order, built once the blocklist is final
+// - hits are not copied, the view is an index into the log (sorted by ip) and its blocking actions, 4 bytes per hit
+// - hour buckets index the view, so an output reads only the time span it needs
+#define STORE_BUCKET  3600
+
+class HitStore {
+public:
+  HitStore()                                  { Clear(); }
+  void        Clear ();
+  void        Build ( const std::vector<LogInfo>& log, const std::vector<char>& block, uint32_t time_min, uint32_t time_max );
+  void        getRange ( uint32_t t0, uint32_t t1, size_t& lo, size_t& hi ) const;   // hits in [t0, t1)
+  size_t      size () const                   { return m_order.size(); }
+  uint32_t    getFirst () const               { return m_order.empty() ? 0 : getTime(0); }   // earliest hit
+
+  // k-th hit in time order
+  uint32_t    getTime ( size_t k ) const      { return m_log[ m_order[k] ].time; }    // epoch seconds
+  uint64_t    getIP ( size_t k ) const        { return m_log[ m_order[k] ].ip; }      // ip key
+  uint32_t    getPage ( size_t k ) const      { return m_log[ m_order[k] ].page; }    // page id
+  char        getBlock ( size_t k ) const     { return m_block[ m_order[k] ]; }       // blocking action
+
+private:
+  const LogInfo*          m_log;
+  const char*             m_block;
+  std::vector<uint32_t>   m_order;    // log index of each hit, in time order
+  uint32_t                m_base;     // start of the first bucket
+  std::vector<size_t>     m_index;    // first hit of each bucket, one more at the end
+};
+
+// density rendering
+// - hits are counted per pixel and blocking class, then tone mapped by log density
+// - classes: 0 = not blocked, 1 = B, 2 = C, 3 = I
+#define VIS_CLASSES   4
+#define VIS_TILE      256
+#define VIS_LEVELS    8
+#define VIS_TILE_MEM  (size_t(512) << 20)     // bytes for all tiles, fewer levels are built above it
+
+struct DensityGrid {
+  void      Resize ( int w, int h )         { xres = w; yres = h; cnt.assign ( size_t(w) * h * VIS_CLASSES, 0 ); }
+  uint32_t* getCell ( int x, int y )        { return &cnt[ (size_t(y) * xres + x) * VIS_CLASSES ]; }
+  const uint32_t* getCell ( int x, int y ) const { return &cnt[ (size_t(y) * xres + x) * VIS_CLASSES ]; }
+
+  int       xres, yres;
+  std::vector<uint32_t> cnt;
+};
+
+// density tile, the counts of VIS_TILE x VIS_TILE cells
+// - cells are by position x * VIS_TILE + y
+// - a sparse tile lists only the cells with hits, a dense tile keeps every cell. it is kept in the smaller form
+struct DensityTile {
+  DensityTile()                             { dense = false; }
+  void      Append ( uint16_t p, const uint32_t* c );     // cells in ascending position
+  void      MakeDense ();
+  void      FromGrid ( const DensityGrid& g );
+  void      ToGrid ( DensityGrid& g ) const;
+  size_t    getBytes () const               { return pos.capacity() * sizeof(uint16_t) + cnt.capacity() * sizeof(uint32_t); }
+  template <class F> void forCells ( F fn ) const;        // fn ( x, y, counts ) for every cell with hits
+
+  bool                  dense;
+  std::vector<uint16_t> pos;                // cell positions, sparse only
+  std::vector<uint32_t> cnt;                // VIS_CLASSES counts per listed cell, or per cell if dense
+};
+
+#define VIS_DENSE_BYTES   (size_t(VIS_TILE) * VIS_TILE * VIS_CLASSES * sizeof(uint32_t))
+#define VIS_CELL_BYTES    (sizeof(uint16_t) + VIS_CLASSES * sizeof(uint32_t))
+
+// density pyramid
+// - level 0 is one tile over all days and the IPv4 space, each level doubles the resolution
+// - tiles are kept only where there are hits. any vis_zoom window renders from the counts, without the hits
+// - all levels together stay under VIS_TILE_MEM, otherwise fewer levels are built
+class DensityPyramid {
+public:
+  DensityPyramid()                          { m_levels = 0; m_bytes = 0; }
+  void      Build ( const HitStore& store, uint32_t first_tm, int days, int levels );
+  void      Render ( Vec4F range, DensityGrid& out ) const;
+  int       SaveTiles ( std::string prefix, int levels ) const;     // the first 'levels' levels
+  int       getLevels () const              { return m_levels; }
+  size_t    numTiles ( int lev ) const      { return m_tiles[lev].size(); }
+  size_t    getBytes () const               { return m_bytes; }
+
+private:
+  bool      BuildLevels ( const HitStore& store, uint32_t first_tm );
+
+  int       m_levels;
+  int       m_days;
+  size_t    m_bytes;
+  std::vector< std::unordered_map<uint64_t, DensityTile> > m_tiles;   // per level, key = ty << 32 | tx
+};
+
+// per-thread scratch for ProcessIPs
+struct IPScratch {
+  std::vector<float>    diffs;
+  std::vector<size_t>   order;          // hits of one IP by time
+  std::vector<uint32_t> page_mark;      // last IP to visit each page
+  uint32_t              mark;
+  HitMerge              hits;
+};
+
+// instrumentation, per pipeline stage
+// - wall and cpu time, items processed, rss and heap deltas, peak rss
+// - hot sub-steps are summed across threads into the running stage
+// - stages and sub-step calls can be recorded as chrome trace events (per-ip steps are summed only)
+#define STEP_MATCH    0     // parse and match log lines, per chunk
+#define STEP_MERGE    1     // merge parsed chunks into the log
+#define STEP_SORT     2     // sorts of hits and pages
+#define STEP_DAYS     3     // daily histogram and metrics, per ip
+#define STEP_MAX      4
+
+struct StepTime {
+  double      secs;           // summed over threads
+  uint64_t    calls, items;
+};
+
+struct StageTime {
+  std::string name;
+  double      start;          // since the run began
+  double      secs, cpu_secs;
+  uint64_t    items;
+  int64_t     rss_delta;      // bytes
+  int64_t     heap_delta;     // bytes, where the allocator reports it
+  size_t      peak_rss;       // peak resident memory at the end of the stage, bytes
+  StepTime    steps[STEP_MAX];
+};
+
+struct TraceEvent {
+  std::string name;
+  int         tid;
+  double      start, dur;     // since the run began
+  uint64_t    items;
+};
+
+class Profiler {
+public:
+  Profiler();
+  void        setTrace ( bool on )            { m_trace = on; }
+  void        setSteps ( bool on )            { m_steps = on; }
+  double      Now ();                         // secs since the run began
+  void        Begin ();
+  void        End ( std::string name, uint64_t items );
+
+  // sub-steps, from any thread. no clock reads or shared counters unless steps are on
+  double      StepStart ()                    { return m_steps ? Now() : 0; }
+  void        Step ( int step, double start, uint64_t items )   { if (m_steps) AddStep ( step, start, items ); }
+  void        WriteReport ( std::string filename, uint64_t hits, const size_t* ips, int threads );
+  void        WriteTrace ( std::string filename );
+  const std::vector<StageTime>& getStages () const  { return m_stages; }
+
+private:
+  static int  ThreadID ();
+  void        AddStep ( int step, double start, uint64_t items );
+  std::chrono::steady_clock::time_point m_t0;
+  double      m_start, m_cpu;                 // running stage
+  size_t      m_rss;
+  int64_t     m_heap;
+  std::atomic<uint64_t>   m_step_ns[STEP_MAX], m_step_calls[STEP_MAX], m_step_items[STEP_MAX];
+  std::vector<StageTime>  m_stages;
+  bool                    m_steps, m_trace;
+  std::mutex              m_trace_mutex;
+  std::vector<TraceEvent> m_events;
+};
 
 class LogRip : public Application {
   public:
@@ -215,49 +806,109 @@ class LogRip : public Application {
   std::string getStr(int k) { Value v = getVal(k, ValueType::STRING); return v.s; }
 
   // loading logs
-  void LoadLog ( std::string filename );
-  void InsertLog(LogInfo i, int lev );
-  void InsertIP(IPInfo i, int lev );
+  void LoadLogs ( std::vector<std::string>& files, size_t from=0, bool live=false );
+  void LoadLog ( std::string filename, size_t from=0, bool live=false );
+  void MergeLogs ( std::vector<size_t>& file_start );
+  int  LoadSnapshot ( std::string snapfile, std::string logfile );
+  void SaveSnapshot ( std::string snapfile, std::string logfile );
+  uint64_t getPolicyHash ();
+  void ParseBlock ( const LogFormat& fmt, const char* data, size_t len, LoadProgress& prog );
+  void ParseChunk ( const LogFormat& fmt, LogChunk& chunk, bool debug_parse );
+  bool ReportProgress ( LoadProgress& prog );
+  int  getThreads ();
+  void InsertLog(size_t first, size_t cnt, int lev );
+  IPInfo* InsertIP(IPInfo i, IPTable& dest, int dest_lev );
+  IPInfo* InsertASN ( const IPInfo& i, uint32_t asn );
   void ProcessIPs( int lev );
+  void ProcessList ( std::vector<IPInfo*>& ips );
+  void ProcessIP ( IPInfo* f, IPScratch& scr );
+  void GatherHits ( IPInfo* f, IPScratch& scr );
   void PrepareDays ();
-  void ClearDayInfo();
-  void InsertDayInfo ( TimeX day, LogInfo& i );	
-  void SortPagesByTime(std::vector<LogInfo>& pages);
-  void SortPagesByName(std::vector<LogInfo>& pages);
+  void SortHitsByIP();
+  void SortPagesByName(std::vector<uint32_t>& pages);
 
   // compute metrics & blocklist
-  void ComputeDailyMetrics (IPInfo* f);
+  void ComputeDailyMetrics (IPInfo* f, const std::vector<size_t>& order);
+  void ComputeRates (IPInfo* f, const std::vector<size_t>& order);
+  void ComputeTop (size_t start, size_t end);
   void ComputeScore ( IPInfo* f );
+  void PrintReason ( IPInfo* f );
   void ComputeBlocklist ();
-  void LookupName (IPInfo* f);
+  void StartLookups ();
+  void FinishLookups ();
   void ConstructIPHash();	
   void ConstructSubnet (int src_lev, int dest_lev);
+  void ComputeGeo ();
+  void ComputeAll ();
   void CreateImg (int xr, int yr);
 
+  // benchmarks
+  void GenerateLog ( std::string filename );
+  void StageBegin ();
+  void StageEnd ( std::string name, uint64_t items=0 );
+  void OutputBench ( std::string filename );
+  void PrintUsage ();
+
+  // follow mode
+  void FollowLog ( std::string filename );
+  int  UpdateHits ( size_t start );
+  void AddDelta ( size_t start, int lev, std::vector<uint64_t>& keys );
+  size_t FirstHit ( IPInfo* f );
+  void RefreshSubnet ( IPInfo* f );
+  void Compact ();
+
   // output results
+  std::string BuildBlocklist ();
+  std::string BlockPrefix ( IPInfo* f );
+  CIDRNet BlockNet ( IPInfo* f );
+  void CollectBlocklist ( std::vector<CIDRNet>& nets );
+  void OutputFirewall ();
   void OutputBlocklist (std::string filename);
   void OutputPages( std::string filename );
   int OutputIPs(int outlev, std::string filename);
-  int OutputIPs(int outlev, int lev, uint32_t parent, FILE* fp);
+  void OutputIP(CSVWriter& out, IPInfo* f);
+  void OutputMetrics(CSVWriter& out, IPInfo* f);
+  int OutputASNs(std::string filename);
+  int OutputRates(std::string filename);
+  int OutputTop(std::string filename);
   void OutputHits (std::string filename);
   void OutputStats (std::string filename, std::string imgname);
   void OutputVis ();
+  void BinHits ( Vec4F range, uint32_t first_tm, size_t lo, size_t hi, DensityGrid& grid );
   void OutputLoads (std::string filename);
-  IPInfo* FindIP(uint32_t ip, int lev);
+  IPInfo* FindIP(uint64_t ip, int lev);
 
-  TimeX       m_date_min;
-  TimeX       m_date_max;
+  uint32_t    m_time_min;       // start of first day
+  uint32_t    m_time_max;       // end of last day
   int         m_total_days;
 
-  std::string m_log_file;
+  std::vector<std::string> m_log_files;
   std::string m_conf_file;
 
   std::vector< LogInfo >  m_Log;
+  size_t                  m_base_hits;      // hits in the sorted base of m_Log, newer hits follow unsorted
+  size_t                  m_log_pos;        // bytes of the log file read
+
+  PageTable               m_Pages;
+
+  IPTable                 m_IPList[SUB_MAX];	
+  std::unordered_map< uint64_t, std::vector<size_t> >  m_Delta[SUB_MAX];   // hits after the base, per IP or subnet, by time
+  std::vector<char>       m_HitBlock;     // blocking action per hit, parallel to m_Log
+
+  GeoDB                   m_Geo;
+  LookupService           m_Lookup;
+  IPTable                 m_ASNList;      // IPs grouped by ASN, keyed by ASN
 
-  IPMap_t                 m_IPList[SUB_MAX];	
+  TopK                    m_TopPages;     // most hit pages, in sketch mode
+  TopK                    m_TopIPs;       // most active IPs, in sketch mode
 
   std::vector< DayInfo >  m_DayList;
 
+  HitStore                m_Store;        // hits by time, for the outputs
+  DensityPyramid          m_Pyramid;      // hit density tiles, for vis_density
+
+  Profiler                m_Prof;
+
   std::vector<ConfigEntry> m_Config;
 
   ImageX      m_img[4];
@@ -277,8 +928,15 @@ uint32_t vecToIP(Vec4F v)
   i += uint32_t(v.w);
   return i;
 }
-Vec4F ipToVec(uint32_t i)
+bool isIPv6(uint64_t ip)
+{
+  // ip keys: IPv4 in the low 32 bits, IPv6 as the upper 64 bits of the address (its /64)
+  return (ip >> 32) != 0;
+}
+Vec4F ipToVec(uint64_t ip)
 {
+  // IPv6 is plotted by its top 32 bits
+  uint32_t i = isIPv6(ip) ? uint32_t(ip >> 32) : uint32_t(ip);
   Vec4F v;
   v.x = (i & 0xFF000000) >> 24;
   v.y = (i & 0x00FF0000) >> 16;
@@ -286,45 +944,140 @@ Vec4F ipToVec(uint32_t i)
   v.w = (i & 0x000000FF);
   return v;
 }
-std::string ipToStr(uint32_t i, char wild='*' )
+std::string ip6ToStr(uint64_t ip, int bits)
 {
+  // network in IPv6 notation, trailing zero groups as :: (2001:db8:12::/48)
+  char buf[64];
+  int n = 0, last = -1;
+  for (int g = 0; g < 4; g++) if ((ip >> (48 - g*16)) & 0xFFFF) last = g;
+  for (int g = 0; g <= last; g++)
+    n += snprintf ( buf + n, 64 - n, "%x:", unsigned((ip >> (48 - g*16)) & 0xFFFF) );
+  snprintf ( buf + n, 64 - n, (last < 0) ? "::/%d" : ":/%d", bits );
+  return buf;
+}
+std::string ipToStr(uint64_t i, int bits=32, char wild='*' )
+{
+  // subnets on octet boundaries use wildcards (1.2.*.*), others CIDR notation (1.2.16.0/20)
+  if (isIPv6(i)) return ip6ToStr(i, bits);
   Vec4F v = ipToVec(i);
+  bool cidr = (bits % 8) != 0;
   std::string a,b,c,d;
-  a = uint32_t(v.x) == 255 ? std::string(1, wild) : iToStr(uint32_t(v.x));
-  b = uint32_t(v.y) == 255 ? std::string(1, wild) : iToStr(uint32_t(v.y));
-  c = uint32_t(v.z) == 255 ? std::string(1, wild) : iToStr(uint32_t(v.z));
-  d = uint32_t(v.w) == 255 ? std::string(1, wild) : iToStr(uint32_t(v.w));
-  return  a+ "." + b + "." + c + "." + d;
-}
-bool memberOf(uint32_t ip, uint32_t parent)
-{
-  uchar pa = (parent & 0xFF000000) >> 24;
-  uchar pb = (parent & 0x00FF0000) >> 16;
-  uchar pc = (parent & 0x0000FF00) >> 8;
-  uchar pd = (parent & 0x000000FF);
-  int shift = (pa==0xFF) ? 32 : (pb==0xFF ? 24 : (pc==0xFF ? 16 : (pd==0x0FF) ? 8 : 0));
-  if (shift==32) return true;
-  uint32_t chk1 = (ip >> shift);
-  uint32_t chk2 = (parent >> shift);
-  return chk1==chk2;
-}
-
-uint32_t getMask(int lev)
-{
-  switch (lev) {
-  case SUB_D:	return 0xFFFFFFFF;		break;
-  case SUB_C:	return 0xFFFFFF00;		break;
-  case SUB_B:	return 0xFFFF0000;		break;
-  case SUB_A:	return 0xFF000000;		break;
-  };
-  return 0x00000000;
+  a = (bits < 8  && !cidr) ? std::string(1, wild) : iToStr(uint32_t(v.x));
+  b = (bits < 16 && !cidr) ? std::string(1, wild) : iToStr(uint32_t(v.y));
+  c = (bits < 24 && !cidr) ? std::string(1, wild) : iToStr(uint32_t(v.z));
+  d = (bits < 32 && !cidr) ? std::string(1, wild) : iToStr(uint32_t(v.w));
+  return  a+ "." + b + "." + c + "." + d + (cidr ? "/" + iToStr(bits) : "");
+}
+
+int getBits(uint64_t ip, int lev)
+{
+  return isIPv6(ip) ? subnet_bits6[lev] : subnet_bits[lev];
+}
+
+uint64_t getMask(uint64_t ip, int lev)
+{
+  // network bits at this level, in the key space of the ip family
+  int bits = isIPv6(ip) ? subnet_bits6[lev] : subnet_bits[lev] + 32;
+  return (bits <= 0) ? 0 : 0xFFFFFFFFFFFFFFFFULL << (64 - bits);
+}
+
+uint64_t getMaskedIP(uint64_t ip, int lev)
+{
+  // network address of the subnet at this level
+  return ip & getMask(ip, lev);
+}
+
+bool memberOf(uint64_t ip, uint64_t parent, int lev)
+{
+  return getMaskedIP(ip, lev) == parent;
+}
+
+int commonPrefix(uint64_t a, uint64_t b)
+{
+  // length of the shared leading bits, within the ip family
+  int n = 0;
+  for (uint64_t x = a ^ b; n < 64 && (x & 0x8000000000000000ULL) == 0; x <<= 1) n++;
+  return isIPv6(a) ? n : n - 32;
+}
+
+std::string cidrToStr(const CIDRNet& c)
+{
+  if (isIPv6(c.net)) return ip6ToStr(c.net, c.bits);
+  return ipToStr(c.net) + "/" + iToStr(c.bits);
+}
+
+void collapseCIDR(std::vector<CIDRNet>& list)
+{
+  // fewest CIDR blocks covering the same addresses
+  // - prefixes become key ranges, merged where they overlap or touch, then split back on power-of-two boundaries
+  // - IPv4 and IPv6 keys never touch (IPv6 keys start at 2^48), so families stay apart
+  std::vector< std::pair<uint64_t, uint64_t> > ranges;
+  for (size_t n = 0; n < list.size(); n++) {
+    int host = (isIPv6(list[n].net) ? 64 : 32) - list[n].bits;
+    uint64_t span = (host >= 64) ? ~0ULL : (1ULL << host) - 1;
+    ranges.push_back ( std::make_pair ( list[n].net & ~span, list[n].net | span ) );
+  }
+  std::sort ( ranges.begin(), ranges.end() );
+
+  list.clear();
+  size_t n = 0;
+  while (n < ranges.size()) {
+    uint64_t lo = ranges[n].first, hi = ranges[n].second;
+    for (n++; n < ranges.size() && (hi == ~0ULL || ranges[n].first <= hi + 1); n++)
+      hi = std::max ( hi, ranges[n].second );
+
+    int fam = isIPv6(lo) ? 64 : 32;
+    for (;;) {
+      // largest block aligned at lo that fits the range
+      int host = 0;
+      for (; host < fam; host++) {
+        uint64_t next = (host + 1 >= 64) ? ~0ULL : (1ULL << (host + 1)) - 1;
+        if ((lo & next) != 0 || (lo | next) > hi) break;
+      }
+      uint64_t span = (host >= 64) ? ~0ULL : (1ULL << host) - 1;
+      CIDRNet c = { lo, fam - host };
+      list.push_back ( c );
+      if ((lo | span) >= hi) break;
+      lo = (lo | span) + 1;
+    }
+  }
 }
 
-uint32_t getMaskedIP(uint32_t ip, int lev)
+uint32_t packDate(int yr, int mo, int day)
 {
-  uint32_t mask = getMask(lev);	
-  uint32_t mip = (ip & mask) | (~mask & 0xFFFFFFFF);	
-  return mip;
+  // days since 1970 from civil date (proleptic gregorian)
+  yr -= (mo <= 2);
+  int era = (yr >= 0 ? yr : yr - 399) / 400;
+  int yoe = yr - era * 400;
+  int doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int days = era * 146097 + doe - 719468;
+  return (days < 0) ? 0 : uint32_t(days) * SEC_PER_DAY;
+}
+
+TimeX unpackTime(uint32_t t)
+{
+  // civil date from days since 1970
+  int z = int(t / SEC_PER_DAY) + 719468;
+  int era = z / 146097;
+  int doe = z - era * 146097;
+  int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int mp = (5 * doy + 2) / 153;
+  int day = doy - (153 * mp + 2) / 5 + 1;
+  int mo = (mp < 10) ? mp + 3 : mp - 9;
+  int yr = yoe + era * 400 + (mo <= 2);
+  int sec = t % SEC_PER_DAY;
+
+  TimeX x;
+  x.SetDate ( mo, day, yr );
+  x.SetTime ( sec / 3600, (sec / 60) % 60, sec % 60 );
+  return x;
+}
+
+std::string writeTime(uint32_t t)
+{
+  return unpackTime(t).WriteDateTime();
 }
 
 void Value::SetValue ( const std::string& str)
@@ -392,7 +1145,41 @@ void LogRip::LoadConfig ( std::string filename )
     {CONF_LOAD_DURATION,    "load_duration",    ValueType::FLOAT,  Value(80) },
     {CONF_LOAD_SCALE,       "load_scale",       ValueType::FLOAT,  Value(40) },
     {CONF_VIS_RES,          "vis_res",          ValueType::VEC4F,  Value( Vec4F(2048,1024,0,0) ) },
-    {CONF_VIS_ZOOM,         "vis_zoom",         ValueType::VEC4F,  Value(Vec4F(0,0,1000,224)) }
+    {CONF_VIS_ZOOM,         "vis_zoom",         ValueType::VEC4F,  Value(Vec4F(0,0,1000,224)) },
+    {CONF_THREADS,          "threads",          ValueType::INT,    Value(0) },
+    {CONF_FOLLOW,           "follow",           ValueType::BOOL,   Value(false) },
+    {CONF_FOLLOW_POLL,      "follow_poll",      ValueType::FLOAT,  Value(0.5f) },
+    {CONF_SNAPSHOT,         "snapshot",         ValueType::STRING, Value(std::string("")) },
+    {CONF_PREFIX_B,         "prefix_b",         ValueType::INT,    Value(16) },
+    {CONF_PREFIX_C,         "prefix_c",         ValueType::INT,    Value(24) },
+    {CONF_TIGHT_PREFIX,     "tight_prefix",     ValueType::BOOL,   Value(false) },
+    {CONF_PREFIX6_B,        "prefix6_b",        ValueType::INT,    Value(32) },
+    {CONF_PREFIX6_C,        "prefix6_c",        ValueType::INT,    Value(48) },
+    {CONF_GEO_DB,           "geo_db",           ValueType::STRING, Value(std::string("")) },
+    {CONF_LOOKUP,           "lookup",           ValueType::BOOL,   Value(false) },
+    {CONF_LOOKUP_HOST,      "lookup_host",      ValueType::STRING, Value(std::string("http://ip-api.com")) },
+    {CONF_LOOKUP_RATE,      "lookup_rate",      ValueType::FLOAT,  Value(15.0f) },
+    {CONF_LOOKUP_CACHE,     "lookup_cache",     ValueType::STRING, Value(std::string("")) },
+    {CONF_BENCH,            "bench",            ValueType::BOOL,   Value(false) },
+    {CONF_GEN_HITS,         "gen_hits",         ValueType::INT,    Value(0) },
+    {CONF_GEN_FILE,         "gen_file",         ValueType::STRING, Value(std::string("gen_log.txt")) },
+    {CONF_GEN_STYLE,        "gen_style",        ValueType::STRING, Value(std::string("apache")) },
+    {CONF_GEN_IPS,          "gen_ips",          ValueType::INT,    Value(20000) },
+    {CONF_GEN_SUBNETS,      "gen_subnets",      ValueType::INT,    Value(2000) },
+    {CONF_GEN_CRAWLERS,     "gen_crawlers",     ValueType::FLOAT,  Value(0.3f) },
+    {CONF_GEN_DAYS,         "gen_days",         ValueType::INT,    Value(30) },
+    {CONF_GEN_SEED,         "gen_seed",         ValueType::INT,    Value(1) },
+    {CONF_REPORT,           "report",           ValueType::STRING, Value(std::string("")) },
+    {CONF_TRACE,            "trace",            ValueType::STRING, Value(std::string("")) },
+    {CONF_BLOCK_NFT,        "block_nft",        ValueType::STRING, Value(std::string("")) },
+    {CONF_BLOCK_IPSET,      "block_ipset",      ValueType::STRING, Value(std::string("")) },
+    {CONF_BLOCK_STATE,      "block_state",      ValueType::STRING, Value(std::string("")) },
+    {CONF_ROLLING,          "rolling",          ValueType::BOOL,   Value(false) },
+    {CONF_SKETCH,           "sketch",           ValueType::BOOL,   Value(false) },
+    {CONF_SKETCH_TOP,       "sketch_top",       ValueType::INT,    Value(100) },
+    {CONF_VIS_DENSITY,      "vis_density",      ValueType::BOOL,   Value(false) },
+    {CONF_VIS_TILES,        "vis_tiles",        ValueType::INT,    Value(0) },
+    {CONF_VIS_TILE_SAVE,    "vis_tile_save",    ValueType::INT,    Value(0) }
   };
 
   if (filename.empty()) {
@@ -432,719 +1219,2452 @@ void LogRip::LoadConfig ( std::string filename )
   printf ("\n");
 }
 
-
-void LogRip::SortPagesByTime(std::vector<LogInfo>& pages)
+static inline int hitByte (const LogInfo& h, int pass)
 {
-  LogInfo tmp;
-
-  std::sort(pages.begin(), pages.end(), [](const LogInfo& a, const LogInfo& b) {
-    return a.date < b.date;
-  });
+  // sort key byte, passes 0-3 are the time, 4-11 the ip key
+  return (pass < 4) ? int((h.time >> (pass * 8)) & 255) : int((h.ip >> ((pass - 4) * 8)) & 255);
 }
 
-void LogRip::SortPagesByName (std::vector<LogInfo>& pages)
+void sortHits (std::vector<LogInfo>& log, size_t first, size_t last, bool by_ip, int threads)
 {
-  LogInfo tmp;
+  // parallel LSD radix sort of log[first..last), by time, or by ip then time
+  // - one byte per pass, least significant first. each pass is stable, so hits at the same second keep log order
+  // - each thread counts and scatters its own slice, in slice order
+  // - passes where all hits share the byte are skipped, e.g. the unused upper ip bytes of IPv4
+  size_t num = last - first;
+  if (num < 2) return;
+  int num_threads = std::max ( 1, std::min ( threads, int(num >> 16) ) );
+  int passes = by_ip ? 12 : 4;
+
+  std::vector<LogInfo> tmp ( num );
+  LogInfo* src = &log[first];
+  LogInfo* dst = &tmp[0];
+  std::vector<size_t> slice ( num_threads + 1 );
+  for (int t = 0; t <= num_threads; t++) slice[t] = num * t / num_threads;
+  std::vector<size_t> cnt ( num_threads * 256 );
+
+  auto run = [&](std::function<void(int)> fn) {
+    if (num_threads == 1) { fn ( 0 ); return; }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) workers.push_back ( std::thread ( fn, t ) );
+    for (int t = 0; t < num_threads; t++) workers[t].join();
+  };
 
-  std::sort(pages.begin(), pages.end(), [](const LogInfo& a, const LogInfo& b) {
-    return a.page < b.page;
-  });
+  for (int pass = 0; pass < passes; pass++) {
+    // count bytes per slice
+    run ( [&](int t) {
+      size_t* c = &cnt[t * 256];
+      memset ( c, 0, 256 * sizeof(size_t) );
+      for (size_t n = slice[t]; n < slice[t+1]; n++) c[ hitByte ( src[n], pass ) ]++;
+    });
+    // skip if one byte value holds all hits
+    bool skip = false;
+    for (int b = 0; b < 256 && !skip; b++) {
+      size_t total = 0;
+      for (int t = 0; t < num_threads; t++) total += cnt[t * 256 + b];
+      if (total == num) skip = true;
+      else if (total > 0) break;
+    }
+    if (skip) continue;
+
+    // output offsets, by byte then slice
+    size_t pos = 0;
+    for (int b = 0; b < 256; b++) {
+      for (int t = 0; t < num_threads; t++) {
+        size_t c = cnt[t * 256 + b];
+        cnt[t * 256 + b] = pos;
+        pos += c;
+      }
+    }
+    // scatter
+    run ( [&](int t) {
+      size_t* off = &cnt[t * 256];
+      for (size_t n = slice[t]; n < slice[t+1]; n++) dst[ off[ hitByte ( src[n], pass ) ]++ ] = src[n];
+    });
+    std::swap ( src, dst );
+  }
+  if (src != &log[first]) memcpy ( &log[first], src, num * sizeof(LogInfo) );
 }
 
-#define T_UNKNOWN         0
-#define T_IP              1
-#define T_NAME            2
-#define T_PAGE            3
-#define T_PLATFORM        4
-#define	T_DATE_DDMMMYY    5
-#define	T_DATE_YYYY_MM_DD 6
-#define T_TIME_HHMMSS     7
-#define T_RETURN          8
-#define T_BYTES           9
-#define T_NUM             10
-#define T_GETPOST         11
-
-struct TokenDef {
-  TokenDef(char t, std::string p)	{type=t; pattern=p;}
-  char          type;
-  std::string   pattern;
-};
-typedef std::vector<TokenDef>  defList;
-
-// capture groups
-std::unordered_map<std::string, TokenDef > tokenToRegex = 
-{
-    {"X.X.X.X",			{T_IP,						R"((\d+\.\d+\.\d+\.\d+))"}},
-    {"AAA",					{T_NAME,					R"(([A-Za-z_\- ]+))"}},
-    {"PAGE",				{T_PAGE,					R"((.*))"}},
-    {"PLATFORM",		{T_PLATFORM,			R"((.*?))"}},
-    {"DD/MMM/YYYY", {T_DATE_DDMMMYY,	R"((\d{2}/[A-Za-z]{3}/\d{4}))"}},
-    {"YYYY-MM-DD",  {T_DATE_YYYY_MM_DD,	R"((\d{4}-\d{2}-\d{2}))"}},
-    {"HH:MM:SS",		{T_TIME_HHMMSS,		R"((\d{2}:\d{2}:\d{2}))"}},
-    {"RETURN",			{T_RETURN,				R"((\d+))"}},
-    {"BYTES",				{T_BYTES,					R"((\d+))"}},
-    {"NNN",					{T_NUM,						R"((\d+))"}},
-    {"GET",					{T_GETPOST,				R"((\b(?:GET|POST|HEAD)\b))"}}
-};
-
-static const std::unordered_map<std::string, int> monthMap = {
-    {"Jan", 1}, {"Feb", 2}, {"Mar", 3}, {"Apr", 4},
-    {"May", 5}, {"Jun", 6}, {"Jul", 7}, {"Aug", 8},
-    {"Sep", 9}, {"Oct",10}, {"Nov",11}, {"Dec",12}
-};
+void LogRip::SortHitsByIP()
+{
+  // sort by ip, then time. stable so hits at the same second keep log order
+  double t = m_Prof.StepStart();
+  sortHits ( m_Log, 0, m_Log.size(), true, getThreads() );
+  m_Prof.Step ( STEP_SORT, t, m_Log.size() );
+}
 
-std::string escapeLiteral(char c) 
+void LogRip::SortPagesByName (std::vector<uint32_t>& pages)
 {
-  static const std::string regexSpecial = R"(\.^$|()[]*+?{})";
-  if (regexSpecial.find(c) != std::string::npos) return "\\" + std::string(1, c);
-  return std::string(1, c);
+  // compare by page rank, same order as by name
+  std::sort(pages.begin(), pages.end(), [this](uint32_t a, uint32_t b) {
+    return m_Pages.getRank(a) < m_Pages.getRank(b);
+  });
 }
 
-// dynamic parser
-// - given a log format string with captured groups (eg. IP, DATE, PAGE)
-// - construct a regex pattern that matches it (FormatToRegex)
-// - then apply the regex pattern to every line of the input log file (ParseInput)
-// - and convert the resulting matches into a loginfo struct (ConvertToLog)
+// time-ordered walk over a range of hits
+// - m_Log is sorted by (ip, time), so a subnet range is a set of sorted runs, one per IP
+// - the runs are merged by time with a heap, hits are never copied
 //
-std::string FormatToRegex(const std::string& format, defList& groupLabels) 
+void HitMerge::Start (const std::vector<LogInfo>& log, size_t first, size_t cnt)
 {
-  std::string pattern;
-  size_t i = 0;
-
-  while (i < format.size()) {
-    if (format[i] == '{') {
-      size_t end = format.find('}', i);
-      if (end == std::string::npos) throw std::runtime_error("Unmatched { in format");
-
-      std::string token = format.substr(i + 1, end - i - 1);
-      auto it = tokenToRegex.find(token);
-      if (it != tokenToRegex.end()) {
-        pattern += it->second.pattern;     // Capturing group
-        groupLabels.push_back( TokenDef(it->second.type, token) );      // For result vector
-      }
-      else {
-        throw std::runtime_error("Unknown token: " + token);
-      }
-      i = end + 1;
-    } else if (format[i] == '*') {
-      pattern += R"(.*?)";  // Non-capturing wildcard
-      ++i;
-    }	else {
-      pattern += escapeLiteral(format[i]);  // Exact literal match
-      ++i;
+  m_log = &log[0];
+  m_heap.clear();
+
+  // find the runs
+  size_t end = first + cnt, s = first;
+  for (size_t n = first + 1; n <= end; n++) {
+    if (n == end || log[n].ip != log[s].ip) {
+      m_heap.push_back ( Run(s, n) );
+      s = n;
     }
   }
-  return pattern;
+  std::make_heap ( m_heap.begin(), m_heap.end(), Later(m_log) );
 }
 
-std::vector<std::string> ParseInput(const std::string& pattern, const std::string& input) 
+bool HitMerge::Next (size_t& n)
 {
-  std::regex rgx(pattern);
-  std::smatch match;
-  std::vector<std::string> results;
+  if (m_heap.empty()) return false;
 
-  if (std::regex_search(input, match, rgx)) {
-    for (size_t i = 1; i < match.size(); ++i) {
-      results.push_back(match[i].str());
-    }
+  if (m_heap.size() == 1) {
+    // single run, already sorted
+    n = m_heap[0].pos++;
+    if (m_heap[0].pos == m_heap[0].end) m_heap.clear();
+    return true;
   }
-  return results;
+  std::pop_heap ( m_heap.begin(), m_heap.end(), Later(m_log) );
+  Run& r = m_heap.back();
+  n = r.pos++;
+  if (r.pos == r.end) m_heap.pop_back();
+  else std::push_heap ( m_heap.begin(), m_heap.end(), Later(m_log) );
+  return true;
 }
 
-char ConvertToLog ( LogInfo& li, char typ, std::string str )
+void HitStore::Clear ()
 {
-  int day, mo, yr, hr, min, sec;
-  std::string val;
-  size_t p1, p2, p3;
-  Vec4F vec;
-
-  switch (typ) {
-  case T_IP:
-    vec = strToVec4("<" + str + ">", '.');
-    if (vec.x == 255 || vec.y == 255 || vec.z == 255 || vec.w == 255) {			// limitation of logrip, 255 not allowed as part of literal (specific) IP
-      li.ip = 0;
-      return 'i';		// printf("**** ERROR: %s\n  IP: %s", buf, str.c_str());			
-    }
-    else {
-      li.ip = vecToIP(vec);
-    }
-    break;
-  case T_DATE_DDMMMYY: {
-    p1 = str.find_first_of('/');					if (p1 == std::string::npos) return 'd';
-    p2 = str.find_first_of('/', p1 + 1);	if (p2 == std::string::npos) return 'd';
-    day = strToI(str.substr(0, p1));
-    val = str.substr(p1 + 1, p2 - p1 - 1); auto it = monthMap.find(val); mo = (it == monthMap.end()) ? 0 : it->second;
-    yr = strToI(str.substr(p2 + 1));
-    li.date.SetDate (mo, day, yr);
-  } break;
-  case T_DATE_YYYY_MM_DD: {
-    p1 = str.find_first_of('-');					if (p1 == std::string::npos) return 'd';
-    p2 = str.find_first_of('-', p1 + 1);		if (p2 == std::string::npos) return 'd';
-    yr = strToI(str.substr(0, p1));
-    mo = strToI(str.substr(p1 + 1, p2 - p1 - 1));
-    day = strToI(str.substr(p2 + 1));
-    li.date.SetDate(mo, day, yr);
-  } break;
-  case T_TIME_HHMMSS:
-    p1 = str.find_first_of(':');					if (p1 == std::string::npos) return 't';
-    p2 = str.find_first_of(':', p1 + 1);	if (p2 == std::string::npos) return 't';
-    hr = strToI(str.substr(0, p1));
-    min = strToI(str.substr(p1 + 1, p2 - p1 - 1));
-    sec = strToI(str.substr(p2 + 1));
-    li.date.SetTime(hr, min, sec);
-    break;
-  case T_PAGE:
-    li.page = str;
-    break;
-  };
-  return 1;
+  m_log = 0x0;
+  m_block = 0x0;
+  m_order.clear();
+  m_index.clear();
+  m_base = 0;
 }
 
-void LogRip::LoadLog (std::string filename)
+void HitStore::Build (const std::vector<LogInfo>& log, const std::vector<char>& blk, uint32_t time_min, uint32_t time_max)
 {
-  std::string lin, str, val;	
-  bool ok; 		
-  std::string reason;
-  Vec4F vec;
-  LogInfo li;
-  char ret;
-
-  bool debug_parse = getB(CONF_DEBUGPARSE);
-
-  FILE* fp = fopen (filename.c_str(), "r" );
-  if (fp == 0x0) {
-    printf ( "ERROR: Unable to open %s\n", filename.c_str() );
-    return;
+  // hits into hour buckets with a counting sort, then each bucket by time
+  // - stable, hits at the same second keep their order in m_Log
+  // - log and block must stay unchanged while the store is used
+  size_t num = log.size();
+  if (num > size_t(UINT32_MAX)) {
+    printf ( "**** ERROR: Hit store holds at most %u hits.\n", UINT32_MAX );
+    exit(-1);
   }
-  printf ( "Reading log: %s\n", filename.c_str() );
-
-  int maxlog = 1e9;
-  long perc = 0, percl = 0;
-  long hits = 0, skipped = 0;
-  char typ;
-
-  fseek(fp, 0, SEEK_END);
-  long size = 0;
-  long max_size = ftell(fp)/1000;
-  fseek(fp, 0, SEEK_SET);
-
-  defList groupLabels;
-  // std::string format = "{X.X.X.X} {AAA} {AAA} [{DD/MMM/YYYY}:{HH:MM:SS} +{NNN}] \"{GET} {PAGE}HTTP/*\" {RETURN} {BYTES} \"*\" {PLATFORM}";
-  // std::string format = "* Started {GET} \"{PAGE}\" for {X.X.X.X} at {YYYY-MM-DD} {HH:MM:SS}";
-  std::string format = getStr( CONF_FORMAT );
-  std::string regexPattern = FormatToRegex ( format, groupLabels );
-
-
-  while (!feof(fp) && hits < maxlog ) {
-
-    // read next line
-    fgets ( m_buf, 65535, fp );
-    lin = m_buf;
-
-    // report percentage complete
-    size = ftell(fp)/1000;
-    perc = (size*100)/max_size; 
-    if ( (perc % 5)==0 && perc != percl) {
-      percl = perc;
-      printf ( " %ld%%. %ld read, %ld skipped.\n", perc, hits, skipped );
-      if (skipped > hits && hits==0) {
-        printf ("*** ERROR: Log not read. Likely a format issue.\n");
-        printf ("Be sure that the format string in your .conf matches the log input.\n");
-        printf ("See logrip instructions. You can also set debugparse=1 to test format strings.\n");
-        printf ("STOPPED.\n");
-        exit(-7);
-      }
-    }
-    if (debug_parse) printf("\n===== %s", lin.c_str());
-
-    // clear parsing 
-    li.clear();				
-    
-    // parse this line
-    std::vector<std::string> results = ParseInput ( regexPattern, lin );
-
-    // process results
-    for (int n = 0; n < results.size(); n++) {
+  m_log = num ? &log[0] : 0x0;
+  m_block = num ? &blk[0] : 0x0;
+  size_t buckets = (time_max - time_min) / STORE_BUCKET + 1;
+  m_base = time_min;
+  m_index.assign ( buckets + 1, 0 );
+  for (size_t n = 0; n < num; n++) m_index[ (log[n].time - time_min) / STORE_BUCKET + 1 ]++;
+  for (size_t b = 0; b < buckets; b++) m_index[b+1] += m_index[b];
+
+  m_order.resize ( num );
+  std::vector<size_t> pos ( m_index.begin(), m_index.end() - 1 );
+  for (size_t n = 0; n < num; n++) m_order[ pos[ (log[n].time - time_min) / STORE_BUCKET ]++ ] = uint32_t(n);
+  for (size_t b = 0; b < buckets; b++) {
+    std::stable_sort ( m_order.begin() + m_index[b], m_order.begin() + m_index[b+1], [&log](uint32_t a, uint32_t c) { return log[a].time < log[c].time; } );
+  }
+}
 
-      typ = groupLabels[n].type;
-      str = results[n];			
+void HitStore::getRange (uint32_t t0, uint32_t t1, size_t& lo, size_t& hi) const
+{
+  // bucket bounds, then the exact times within the edge buckets
+  lo = hi = 0;
+  if (m_order.empty() || t1 <= t0) return;
+  size_t buckets = m_index.size() - 1;
+  size_t b0 = (t0 <= m_base) ? 0 : std::min ( buckets, size_t((t0 - m_base) / STORE_BUCKET) );
+  size_t b1 = (t1 <= m_base) ? 0 : std::min ( buckets, size_t((t1 - m_base) / STORE_BUCKET) + 1 );
+  const LogInfo* log = m_log;
+  auto before = [log](uint32_t n, uint32_t t) { return log[n].time < t; };
+  lo = std::lower_bound ( m_order.begin() + m_index[b0], m_order.begin() + m_index[b1], t0, before ) - m_order.begin();
+  hi = std::lower_bound ( m_order.begin() + lo, m_order.begin() + m_index[b1], t1, before ) - m_order.begin();
+}
 
-      ret = ConvertToLog (li, typ, str);
-    }
-    
-    // add item to log (if valid)
-    if (li.isValid()) {
-      if (debug_parse) printf("   OK. LOG: DATE=%s, IP=%s, PAGE=%s\n", li.date.WriteDateTime().c_str(), ipToStr(li.ip).c_str(), li.page.c_str());
-      m_Log.push_back(li);
-      hits++;
+IPInfo& IPTable::Insert (uint64_t ip, bool& created)
+{
+  // IPs arrive in ascending order, so this is almost always an append
+  created = false;
+  if (!m_list.empty() && m_list.back().ip == ip) return m_list.back();
+
+  std::vector<IPInfo>::iterator it = m_list.end();
+  if (!m_list.empty() && m_list.back().ip > ip) {
+    it = std::lower_bound ( m_list.begin(), m_list.end(), ip, [](const IPInfo& a, uint64_t b) { return a.ip < b; } );
+    if (it->ip == ip) return *it;
+  }
+  created = true;
+  if (m_sketch) m_uniq.insert ( m_uniq.begin() + (it - m_list.begin()), UniqSketch() );
+  if (m_rolling) m_rate.insert ( m_rate.begin() + (it - m_list.begin()), RateState() );
+  it = m_list.insert ( it, IPInfo() );
+  it->ip = ip;
+  return *it;
+}
 
-    }	else {
-      skipped++;
-      if (debug_parse) {
-        if (results.size() == 0) reason = "Failed to match.";
-        else if (ret == 'i') reason = "IP not handled (contains 255).";
-        else if (li.ip == 0) reason = "No IP found.";
-        else if (li.date.isEmpty()) reason = "No date found.";
-        else if (li.page.empty()) reason = "No page found."; 
-        printf("   SKIPPED. Reason: %s\n", reason.c_str() );
-      }
+void IPTable::Merge (std::vector<IPInfo>& add)
+{
+  // merge new records (sorted, not yet in table) in one pass
+  if (add.empty()) return;
+  std::vector<IPInfo> out;
+  std::vector<UniqSketch> uniq;
+  std::vector<RateState> rate;
+  out.reserve ( m_list.size() + add.size() );
+  if (m_sketch) uniq.reserve ( out.capacity() );
+  if (m_rolling) rate.reserve ( out.capacity() );
+  size_t a = 0, b = 0;
+  while (a < m_list.size() || b < add.size()) {
+    if (b == add.size() || (a < m_list.size() && m_list[a].ip < add[b].ip)) {
+      if (m_sketch) uniq.push_back ( m_uniq[a] );
+      if (m_rolling) rate.push_back ( m_rate[a] );
+      out.push_back ( m_list[a++] );
+    } else {
+      if (m_sketch) uniq.push_back ( UniqSketch() );
+      if (m_rolling) rate.push_back ( RateState() );
+      out.push_back ( add[b++] );
     }
-    
   }
+  m_list.swap ( out );
+  m_uniq.swap ( uniq );
+  m_rate.swap ( rate );
+}
 
-  printf("\n" );
+size_t IPTable::LowerBound (uint64_t ip)
+{
+  std::vector<IPInfo>::iterator it;
+  it = std::lower_bound ( m_list.begin(), m_list.end(), ip, [](const IPInfo& a, uint64_t b) { return a.ip < b; } );
+  return size_t(it - m_list.begin());
+}
 
-  if (m_Log.size() == 0) {
-    printf ("**** ERROR: No logs found. Log format may be different.\n");
-    exit(-2);
-  }	
+IPInfo* IPTable::Find (uint64_t ip)
+{
+  size_t n = LowerBound ( ip );
+  if (n == m_list.size() || m_list[n].ip != ip) return 0x0;
+  return &m_list[n];
+}
 
+IPLookup* IPTable::getLookup (uint64_t ip)
+{
+  std::unordered_map<uint64_t, IPLookup>::iterator it = m_lookup.find ( ip );
+  return (it == m_lookup.end()) ? 0x0 : &it->second;
 }
 
+bool CSVWriter::Open (std::string filename)
+{
+  Close ();
+  m_fp = fopen ( filename.c_str(), "wt" );
+  if (m_fp == 0x0) return false;
+  m_buf.resize ( CSV_BUF );
+  m_len = 0;
+  return true;
+}
 
-void LogRip::InsertLog ( LogInfo i, int lev )
+void CSVWriter::Close ()
 {
-  // find records
-  IPMap_iter it;
-  IPInfo info;
+  if (m_fp == 0x0) return;
+  Flush ();
+  fclose ( m_fp );
+  m_fp = 0x0;
+}
 
-  IPMap_t& list = m_IPList[ lev ];
+void CSVWriter::Flush ()
+{
+  if (m_len > 0 && m_fp != 0x0) fwrite ( &m_buf[0], 1, m_len, m_fp );
+  m_len = 0;
+}
 
-  // find or insert
-  it = list.find(i.ip);
-  if (it == list.end()) {
-    it = list.insert(it, std::make_pair(i.ip, info));
-    it->second.lev = lev;
-    it->second.page_cnt = 0;
-    it->second.start_date = i.date;
-    it->second.end_date = i.date;
-    it->second.ip_cnt = 1;		
+void CSVWriter::Str (const char* str, size_t len)
+{
+  if (m_len + len > CSV_BUF) {
+    Flush ();
+    if (len > CSV_BUF) { fwrite ( str, 1, len, m_fp ); return; }
   }
-  // update
-  it->second.ip = i.ip;
-  it->second.pages.push_back(i);
-  it->second.page_cnt++;
-  if (i.date < it->second.start_date)	it->second.start_date = i.date;
-  if (i.date > it->second.end_date)		it->second.end_date = i.date;
+  memcpy ( &m_buf[m_len], str, len );
+  m_len += len;
 }
 
-IPInfo* LogRip::FindIP (uint32_t ip, int lev)
+void CSVWriter::Int (long long v)
 {
-  IPMap_iter it;
-  IPMap_t& list = m_IPList[lev];
-
-  ip = getMaskedIP( ip, lev );
-
-  it = list.find( ip );
-  if (it==list.end()) return 0x0;
-
-  return &it->second;
+  char tmp[24];
+  int n = 24;
+  unsigned long long u = (v < 0) ? 0ULL - (unsigned long long) v : (unsigned long long) v;
+  do { tmp[--n] = '0' + (u % 10); u /= 10; } while (u > 0);
+  if (v < 0) tmp[--n] = '-';
+  Str ( tmp + n, 24 - n );
 }
 
-
-void LogRip::ConstructIPHash()
+void CSVWriter::Float (double v, int prec)
 {
-  // Insert raw log entries into D-level IP hash
-  for (int n = 0; n < m_Log.size(); n++) {
-    InsertLog (m_Log[n], SUB_D );
+  static const double scales[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  char tmp[64];
+  double r = fabs(v) * scales[prec];
+
+  // printf rounds the exact binary value. the scaled value is only near-exact,
+  // so values close to a rounding tie, large or not finite, go through snprintf
+  double fl = floor(r);
+  if (!(r < 1e12) || fabs ( (r - fl) - 0.5 ) < 1e-3) {
+    Str ( tmp, snprintf ( tmp, 64, "%.*f", prec, v ) );
+    return;
   }
+  unsigned long long q = (unsigned long long) fl + ((r - fl) > 0.5 ? 1 : 0);
+  int n = 64;
+  for (int d = 0; d < prec; d++) { tmp[--n] = '0' + (q % 10); q /= 10; }
+  if (prec > 0) tmp[--n] = '.';
+  do { tmp[--n] = '0' + (q % 10); q /= 10; } while (q > 0);
+  if (std::signbit(v)) tmp[--n] = '-';
+  Str ( tmp + n, 64 - n );
 }
 
-void LogRip::PrepareDays()
+void CSVWriter::IP (uint64_t ip, int bits, char wild)
 {
-  // determine date range of entire dataset
-  IPMap_t& list = m_IPList[SUB_D];	
-
-  m_date_min = list.begin()->second.start_date;
-  m_date_max = list.begin()->second.end_date;
-
-  std::map<uint32_t, IPInfo>::iterator it;
-  for (it = list.begin(); it != list.end(); it++) {
-    if (it->second.start_date < m_date_min)	m_date_min = it->second.start_date;
-    if (it->second.end_date > m_date_max)		m_date_max = it->second.end_date;
-  }	
+  // same as ipToStr
+  if (isIPv6(ip)) { Str ( ip6ToStr(ip, bits) ); return; }
+  bool cidr = (bits % 8) != 0;
+  for (int k = 24; k >= 0; k -= 8) {
+    if (24 - k >= bits && !cidr) Char ( wild ); else Int ( (ip >> k) & 0xFF );
+    if (k > 0) Char ( '.' );
+  }
+  if (cidr) { Char ( '/' ); Int ( bits ); }
+}
 
-  // prepare days structure
-  m_date_min.ClearTime();
-  m_date_max.ClearTime();	m_date_max.AdvanceDays(1); m_date_max.AdvanceSec(-1);
-  m_total_days = m_date_max.GetElapsedDays(m_date_min) + 1;
+#define PAGE_NONE     0xFFFFFFFF
 
-  dbgprintf ( "  Start date: %s\n", m_date_min.WriteDateTime().c_str() );
-  dbgprintf ( "  End date:   %s\n", m_date_max.WriteDateTime().c_str() );
-  dbgprintf ( "  Total days: %d\n", m_total_days );
-  
-  TimeX curr_day = m_date_min;		// first day of data	
+void PageTable::Clear ()
+{
+  m_chars.clear();
+  m_offs.clear();
+  m_lens.clear();
+  m_hashes.clear();
+  m_robots.clear();
+  m_rank.clear();
+  m_slots.assign ( 1024, PAGE_NONE );
+  Intern ( "", 0 );                     // id 0 = empty page
+}
 
-  // prepare memory for days
-  for (int d = 0; d < m_total_days; d++) {
-    m_DayList.push_back ( DayInfo(curr_day) );
-    curr_day.AdvanceDays(1);
+uint64_t PageTable::Hash (const char* str, int len)
+{
+  // FNV-1a
+  uint64_t h = 14695981039346656037ULL;
+  for (int n = 0; n < len; n++) {
+    h ^= (unsigned char) str[n];
+    h *= 1099511628211ULL;
   }
+  return h;
 }
 
-void LogRip::ClearDayInfo()
+void PageTable::Rehash (size_t slots)
 {
-  for (int d=0; d < m_total_days; d++)
-    m_DayList[d].pages.clear ();
+  size_t mask = slots - 1, s;
+  m_slots.assign ( slots, PAGE_NONE );
+  for (uint32_t id = 0; id < Count(); id++) {
+    for (s = m_hashes[id] & mask; m_slots[s] != PAGE_NONE; s = (s + 1) & mask);
+    m_slots[s] = id;
+  }
 }
 
-void LogRip::InsertDayInfo(TimeX date, LogInfo& i)
+uint32_t PageTable::Intern (const char* str, int len)
 {
-  //date.ClearTime();
-  int day = date.GetElapsedDays ( m_date_min );
-
-  //dbgprintf ( " DAY CHK: day#: %d, day, dmin: %s, daydate:%s, date:%s\n", day, m_date_min.WriteDateTime().c_str(), m_DayList[day].date.WriteDateTime().c_str(), date.WriteDateTime().c_str() );	
-  assert( m_DayList[day].date.isSameDay( date ) );
+  uint64_t h = Hash ( str, len );
+  size_t mask = m_slots.size() - 1;
+  size_t s;
+  uint32_t id;
+
+  // find existing
+  for (s = h & mask; (id = m_slots[s]) != PAGE_NONE; s = (s + 1) & mask) {
+    if (m_hashes[id] == h && m_lens[id] == len && memcmp ( getStr(id), str, len ) == 0) return id;
+  }
 
-  m_DayList[day].pages.push_back ( i );
+  // insert new
+  id = Count();
+  m_offs.push_back ( m_chars.size() );
+  m_lens.push_back ( len );
+  m_hashes.push_back ( h );
+  m_chars.insert ( m_chars.end(), str, str + len );
+  m_chars.push_back ( '\0' );
+  m_robots.push_back ( strstr ( getStr(id), "robots.txt" ) != 0x0 );
+  m_slots[s] = id;
+
+  if (Count() * 2 > m_slots.size()) Rehash ( m_slots.size() * 2 );     // keep load under 50%
+  return id;
 }
 
+void PageTable::Merge (const PageTable& src, std::vector<uint32_t>& remap)
+{
+  // intern all pages of another table, remap gives src id -> new id
+  remap.resize ( src.Count() );
+  for (uint32_t id = 0; id < src.Count(); id++)
+    remap[id] = Intern ( src.getStr(id), src.getLen(id) );
+}
 
-void LogRip::ComputeDailyMetrics ( IPInfo* f)
+void PageTable::BuildRanks ()
 {
-  // daily metrics
-  // - num_robots				all accesses to robots.txt
-  // - max_consecutive	maximum consecutive days	
-  // - elapsed					num elapsed days
-  // - daily_min_hit		lowest hits per day
-  // - daily_max_hit		highest hits per day  
-  // - daily_min_ppm		lowest daily pages/min
-  // - daily_max_ppm		highest daily pages/min
-  // - daily_min_range	lowest daily range (start to end in hours)
-  // - daily_max_range	highest daily range (start to end in hours)
-    
-  LogInfo p, pl;
-  int consecutive = 0;
-  int daily_hits;
-  float ave_ppm, range, ave_hits, gap;
-  float dt;
+  // rank every page by name, so hits can be ordered by name using integers
+  std::vector<uint32_t> order ( Count() );
+  for (uint32_t id = 0; id < Count(); id++) order[id] = id;
+  std::sort ( order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return strcmp ( getStr(a), getStr(b) ) < 0;
+  });
+  m_rank.resize ( Count() );
+  for (uint32_t r = 0; r < Count(); r++) m_rank[ order[r] ] = r;
+}
 
-  f->max_consecutive = 1;
-  f->daily_min_hit = 1e7;
-  f->daily_max_hit = 0;
-  f->daily_min_ppm = 1e7;
-  f->daily_max_ppm = 0;
-  f->daily_min_range = 1440;
-  f->daily_max_range = 0;
-  f->num_robots = 0;
-  f->num_days = 0;
-  f->daily_ave_hit = 0;
+// raw array i/o for snapshots
+template<class T> void writeArray ( FILE* fp, const std::vector<T>& v )
+{
+  uint64_t n = v.size();
+  fwrite ( &n, sizeof(n), 1, fp );
+  if (n > 0) fwrite ( &v[0], sizeof(T), n, fp );
+}
+template<class T> bool readArray ( const char*& p, const char* end, std::vector<T>& v )
+{
+  uint64_t n;
+  if (size_t(end - p) < sizeof(n)) return false;
+  memcpy ( &n, p, sizeof(n) );
+  p += sizeof(n);
+  if (n > size_t(end - p) / sizeof(T)) return false;
+  v.resize ( n );
+  if (n > 0) memcpy ( &v[0], p, n * sizeof(T) );
+  p += n * sizeof(T);
+  return true;
+}
 
-  ave_hits = 0;
+void PageTable::Write (FILE* fp) const
+{
+  writeArray ( fp, m_chars );
+  writeArray ( fp, m_offs );
+  writeArray ( fp, m_lens );
+  writeArray ( fp, m_hashes );
+  writeArray ( fp, m_robots );
+  writeArray ( fp, m_rank );
+  writeArray ( fp, m_slots );
+}
 
-  for (int d = 0; d < m_total_days; d++) {
-    
-    if (m_DayList[d].pages.size() > 0) {
-
-      // count consecutive pages
-      if (d==0 || m_DayList[d-1].pages.size() !=0 ) consecutive++; else consecutive = 0;
-      if (consecutive > f->max_consecutive) f->max_consecutive = consecutive;
-
-      // get daily metrics
-      daily_hits = m_DayList[d].pages.size(); 
-      p = m_DayList[d].pages[ daily_hits-1 ];
-      pl = m_DayList[d].pages[0];			
-      range = p.date.GetElapsedMin ( pl.date );		// range in minutes
-      ave_hits += daily_hits;
-      f->num_days++;
-      
-      // get each pages for: robot cnt, time deltas			
-      ave_ppm = 0;
-      gap = 0;
-      for (int j=0; j < m_DayList[d].pages.size(); j++) {
-        p = m_DayList[d].pages[j];
-        if (p.page.find("robots.txt") != std::string::npos ) f->num_robots++;				
-        if (j > 0) {
-          dt = p.date.GetElapsedMin (pl.date);
-          ave_ppm += dt;
-          if (dt > gap) gap = dt;
-        }				
-        pl = p;				
-      }
-      ave_ppm = (daily_hits==1) ? 0 : (daily_hits - 1) / ave_ppm;
-
-      range -= gap;
-
-      // find metric min/max for each day
-      if (daily_hits < f->daily_min_hit)	f->daily_min_hit = daily_hits;
-      if (daily_hits > f->daily_max_hit)	f->daily_max_hit = daily_hits;
-      if (daily_hits >= 3 ) {
-          if (ave_ppm < f->daily_min_ppm) f->daily_min_ppm = ave_ppm;
-          if (ave_ppm > f->daily_max_ppm) f->daily_max_ppm = ave_ppm;
-          if (range < f->daily_min_range) f->daily_min_range = range;
-          if (range > f->daily_max_range) f->daily_max_range = range;				
-      }
-    }
+bool PageTable::Read (const char* data, size_t len)
+{
+  // arrays are loaded as is, no rehash
+  const char* p = data, *end = data + len;
+  bool ok = readArray ( p, end, m_chars ) && readArray ( p, end, m_offs ) && readArray ( p, end, m_lens ) &&
+            readArray ( p, end, m_hashes ) && readArray ( p, end, m_robots ) && readArray ( p, end, m_rank ) &&
+            readArray ( p, end, m_slots );
+  if (!ok || m_lens.size() != m_offs.size() || m_slots.empty() || (m_slots.size() & (m_slots.size()-1)) != 0) {
+    Clear ();
+    return false;
   }
-
-  if (f->daily_min_hit == 1e7) f->daily_min_hit = 0;	
-  if (f->daily_min_ppm == 1e7) f->daily_min_ppm = 0;
-  if (f->daily_max_ppm == 1e7) f->daily_max_ppm = 0;
-  if (f->daily_min_range == 1440) f->daily_min_range = 0;
-  if (f->num_days > 0) ave_hits /= f->num_days;
-  f->daily_pages = ave_hits;
-  f->daily_ave_hit = ave_hits;
+  return true;
 }
 
+#define T_UNKNOWN         0
+#define T_IP              1
+#define T_NAME            2
+#define T_PAGE            3
+#define T_PLATFORM        4
+#define	T_DATE_DDMMMYY    5
+#define	T_DATE_YYYY_MM_DD 6
+#define T_TIME_HHMMSS     7
+#define T_RETURN          8
+#define T_BYTES           9
+#define T_NUM             10
+#define T_GETPOST         11
+#define T_LITERAL         12
+#define T_WILDCARD        13
 
-void LogRip::ComputeScore (IPInfo* f)
-{	
-  // blocking score
-  // example:	
-  // +1  rate throttle (daily hit > 20, ppm > 20)
-  // +2  consecusive metric (days > 5, hr/day > 6)
-  // +3  daily range (hr/day > 6)
-  // +4  day thottle (hits/day > 100)
-  // +5  subnet (# ips > 40)
-  // +10 subnet C (/w any other blocking)
-  // +20 subnet B (/w any other blocking)
-
-  int score = 0;
+struct TokenDef {
+  TokenDef(char t, std::string n)	{type=t; name=n;}
+  char          type;
+  std::string   name;
+};
+typedef std::vector<TokenDef>  defList;
 
-  if (f->lev == SUB_B && f->ip_cnt < getI(CONF_MIN_IPB)) return;
-  if (f->lev == SUB_C && f->ip_cnt < getI(CONF_MIN_IPC)) return;
-  
-  if (f->lev == SUB_C && f->ip_cnt > getI(CONF_MAX_IPC)) score = 6;
-  if (f->num_robots > getI(CONF_MAX_ROBOT) )        score = 5;
-  if (f->daily_max_hit > getI(CONF_MAX_DAILY_HITS)) score = 4;
-  if (f->daily_max_range > getI(CONF_MAX_DAILY_RANGE)) score = 3;
-  if (f->max_consecutive >= getI(CONF_MAX_CONSEC_DAYS) && f->daily_max_range > getI(CONF_MAX_CONSEC_RANGE) ) score = 2;
-  if (f->daily_ave_hit > getI(CONF_MAX_DAILY_AVE) && f->daily_max_ppm > getF(CONF_MAX_DAILY_PPM)) score = 1;
+// capture groups
+std::unordered_map<std::string, char> tokenTypes =
+{
+    {"X.X.X.X",			T_IP},                // \d+\.\d+\.\d+\.\d+ or IPv6
+    {"AAA",					T_NAME},              // [A-Za-z_\- ]+
+    {"PAGE",				T_PAGE},              // .*
+    {"PLATFORM",		T_PLATFORM},          // .*?
+    {"DD/MMM/YYYY", T_DATE_DDMMMYY},      // \d{2}/[A-Za-z]{3}/\d{4}
+    {"YYYY-MM-DD",  T_DATE_YYYY_MM_DD},   // \d{4}-\d{2}-\d{2}
+    {"HH:MM:SS",		T_TIME_HHMMSS},       // \d{2}:\d{2}:\d{2}
+    {"RETURN",			T_RETURN},            // \d+
+    {"BYTES",				T_BYTES},             // \d+
+    {"NNN",					T_NUM},               // \d+
+    {"GET",					T_GETPOST}            // \b(GET|POST|HEAD)\b
+};
 
-  bool reasons = getB(CONF_REASONS);
-  if (reasons && score > 0 ) {    
-    std::string whystr="";
-    switch (score) {
-    case 6: whystr = "#mach"; break;
-    case 5: whystr = "robots"; break;
-    case 4: whystr = "daily hits"; break;
-    case 3: whystr = "daily range"; break;
-    case 2: whystr = "consecutive"; break;
-    case 1: whystr = "too fast"; break;
-    };
-    if (f->lev==SUB_B) whystr += " B-subnet";
-    if (f->lev==SUB_C) whystr += " C-subnet";
-    printf ( "  IP: %s, Reason: %s\n", ipToStr(f->ip).c_str(), whystr.c_str() );      // print cause of blocking
-  }
-  
-  f->score = score;
-  
-  f->block = 0;  // blocking action is not computed here
-}
+static const char* monthNames[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
+static inline bool isDigit(char c)    { return c >= '0' && c <= '9'; }
+static inline bool isAlpha(char c)    { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'); }
+static inline bool isWord(char c)     { return isDigit(c) || isAlpha(c) || c == '_'; }
+static inline bool isHex(char c)      { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+static inline bool isNameChar(char c) { return isAlpha(c) || c == '_' || c == '-' || c == ' '; }
 
-void LogRip::ProcessIPs( int lev )
+static inline int parseNum(const char* s, int len)
 {
-  // Process IPs
-  IPMap_t& list = m_IPList[ lev ];
+  int v = 0;
+  for (int n = 0; n < len; n++) v = v * 10 + (s[n] - '0');
+  return v;
+}
 
-  std::vector<float> diffs;
+// log format element
+// - literal text, a {TOKEN}, or a * wildcard
+struct FormatElem {
+  char          type;     // T_LITERAL, T_WILDCARD or token type
+  std::string   text;     // literal text, or token name
+  int           group;    // capture group index (-1 = not captured)
+};
 
-  std::map<uint32_t, IPInfo>::iterator it;
+// token span
+// - points into the line buffer, no allocation per line
+struct TokenSpan {
+  const char*   s;
+  int           len;
+};
 
-  for (it = list.begin(); it != list.end(); it++) {
+// match result
+struct LogMatch {
+  std::vector<TokenSpan>  caps;       // one span per capture group
+  int           fail_elem;            // furthest element that failed to match
+  int           fail_col;             // column where it failed
+};
 
-    IPInfo* f = &it->second;		
+// compiled log format
+// - given a log format string with captured groups (eg. IP, DATE, PAGE)
+// - compile it into a list of elements (Compile)
+// - then scan every line of the input log left-to-right (Match)
+// - and convert the resulting spans into a loginfo struct (ConvertToLog)
+//
+// Fixed-form tokens (IP, dates, times, numbers) are parsed by their exact grammar.
+// Variable tokens (AAA, PAGE, PLATFORM, *) end at the first position where the next
+// element matches, so each line is scanned once with no backtracking.
+//
+class LogFormat {
+public:
+  void Compile ( const std::string& format );
+  bool Match ( const char* buf, int len, LogMatch& m ) const;
+  std::string DescribeFailure ( const LogMatch& m ) const;
+
+  int  NumGroups() const          { return (int) m_groups.size(); }
+  char GroupType(int n) const     { return m_groups[n].type; }
+
+private:
+  bool MatchAt ( const char* buf, int start, int len, LogMatch& m ) const;
+  int  ScanElem ( int e, const char* buf, int p, int len ) const;
+  int  ScanFixed ( char type, const char* buf, int p, int len ) const;
+  int  ScanVariable ( int e, const char* buf, int p, int len ) const;
+  bool isVariable ( char type ) const   { return type == T_NAME || type == T_PAGE || type == T_PLATFORM || type == T_WILDCARD; }
+  bool inClass ( char type, char c ) const { return (type == T_NAME) ? isNameChar(c) : true; }
+
+  defList                   m_groups;
+  std::vector<FormatElem>   m_elems;
+};
 
-    // sort pages by name for unique count
-    SortPagesByName(f->pages);
+void LogFormat::Compile (const std::string& format)
+{
+  FormatElem el;
+  size_t i = 0;
 
-    // count unique pages
-    f->uniq_cnt = 1;
-    for (int n = 1; n < f->pages.size(); n++) {
-      if (f->pages[n].page != f->pages[n-1].page )
-        f->uniq_cnt++;
-    }
+  m_groups.clear();
+  m_elems.clear();
 
-    // keep pages sorted by time 
-    SortPagesByTime( f->pages );
+  while (i < format.size()) {
+    if (format[i] == '{') {
+      size_t end = format.find('}', i);
+      if (end == std::string::npos) throw std::runtime_error("Unmatched { in format");
 
-    // get total elapsed 
-    TimeX	curr_day = f->start_date; 
-    curr_day.ClearTime();
-    f->elapsed = f->end_date.GetElapsedDays(f->start_date);
-    
-    // construct histogram by day
-    ClearDayInfo ();		
-    for (int n = 0; n < f->pages.size(); n++) {
-      if (! f->pages[n].date.isSameDay ( curr_day ) ) {
-        curr_day = f->pages[n].date;      // goto next day
-        curr_day.ClearTime();	
-      }			
-      InsertDayInfo ( curr_day, f->pages[n] );
-    }
-    
-    // compute daily metrics
-    ComputeDailyMetrics ( f );
-
-    // print day info (debugging)
-    /* dbgprintf("START %s: %s\n", ipToStr(it->first).c_str(), curr_day.WriteDateTime().c_str());
-    for (int d = 0; d < m_total_days; d++) {
-      if (m_DayList[d].pages.size() > 0) {
-        dbgprintf("  --> NEXT DAY: %s\n", m_DayList[d].date.WriteDateTime().c_str());
-        for (int j = 0; j < m_DayList[d].pages.size(); j++) {
-          dbgprintf("   %s, %s\n", m_DayList[d].pages[j].date.WriteDateTime().c_str(), m_DayList[d].pages[j].page.c_str());
-        }
+      std::string token = format.substr(i + 1, end - i - 1);
+      auto it = tokenTypes.find(token);
+      if (it == tokenTypes.end()) {
+        throw std::runtime_error("Unknown token: " + token);
       }
+      el.type = it->second;
+      el.text = token;
+      el.group = (int) m_groups.size();                     // capturing group
+      m_groups.push_back( TokenDef(it->second, token) );    // for result spans
+      m_elems.push_back( el );
+      i = end + 1;
+    } else if (format[i] == '*') {
+      el.type = T_WILDCARD;                                 // non-capturing wildcard
+      el.text = "*";
+      el.group = -1;
+      m_elems.push_back( el );
+      ++i;
+    }	else {
+      if (m_elems.empty() || m_elems.back().type != T_LITERAL) {
+        el.type = T_LITERAL;                                // exact literal match
+        el.text = "";
+        el.group = -1;
+        m_elems.push_back( el );
+      }
+      m_elems.back().text += format[i];
+      ++i;
     }
-    dbgprintf ( "  METRICS %s\n", ipToStr(it->first).c_str());
-    dbgprintf ( "  consecutive: %d\n", f->max_consecutive);
-    dbgprintf ( "  robots.txt:  %d\n", f->num_robots);
-    dbgprintf ( "  daily hits:  min %f, max %f (hits), AVE: %f (hits)\n", f->daily_min_hit, f->daily_max_hit, f->daily_ave_hit);
-    dbgprintf ( "  daily ppm:   min %f, max %f (page/min)\n", f->daily_min_ppm, f->daily_max_ppm);
-    dbgprintf ( "  daily range: min %f, max %f (mins)\n", f->daily_min_range, f->daily_max_range);   */
-    
-    // compute the page time deltas (frequency)
-    float d;
-    diffs.clear ();
-    for (int i = 1; i < f->pages.size(); i++) {
-      d = f->pages[i].date.GetElapsedSec(f->pages[i-1].date);
-      diffs.push_back ( d );
-    }
-
-    // get median (ignore outliers and time gaps)
-    f->visit_freq = (diffs.size()==0) ? 0 : diffs[ diffs.size()/2 ];        // median
-    f->visit_time = f->end_date.GetElapsedSec(f->start_date) / f->page_cnt; // est. visit time
-    f->elapsed = f->end_date.GetElapsedDays(f->start_date);
+  }
+}
 
-    // Compute blocklist score
-    ComputeScore ( f );
+int LogFormat::ScanFixed (char type, const char* buf, int p, int len) const
+{
+  // fixed-form tokens. returns end of token, or -1 if no match
+  const char* mask = 0x0;
+
+  switch (type) {
+  case T_IP: {
+    // dotted quad, else IPv6 (hex groups with at least two colons, may end in a dotted quad)
+    int s = p, colons = 0;
+    for (int k = 0; k < 4; k++) {
+      if (k > 0) { if (p >= len || buf[p] != '.') break; p++; }
+      int d = p;
+      while (p < len && isDigit(buf[p])) p++;
+      if (p == d) break;
+      if (k == 3) return p;
+    }
+    for (p = s; p < len && (isHex(buf[p]) || buf[p] == ':' || buf[p] == '.'); p++) colons += (buf[p] == ':');
+    return (colons >= 2) ? p : -1;
+  }
+  case T_RETURN: case T_BYTES: case T_NUM: {
+    int s = p;
+    while (p < len && isDigit(buf[p])) p++;
+    return (p == s) ? -1 : p;
+  }
+  case T_GETPOST: {
+    if (p > 0 && isWord(buf[p-1])) return -1;
+    int n = 0;
+    if      (p + 3 <= len && memcmp(buf + p, "GET", 3) == 0)  n = 3;
+    else if (p + 4 <= len && memcmp(buf + p, "POST", 4) == 0) n = 4;
+    else if (p + 4 <= len && memcmp(buf + p, "HEAD", 4) == 0) n = 4;
+    if (n == 0 || (p + n < len && isWord(buf[p+n]))) return -1;
+    return p + n;
+  }
+  case T_DATE_DDMMMYY:    mask = "99/AAA/9999"; break;
+  case T_DATE_YYYY_MM_DD: mask = "9999-99-99";  break;
+  case T_TIME_HHMMSS:     mask = "99:99:99";    break;
+  default: return -1;
+  }
 
+  // match against mask. 9 = digit, A = alpha, other = literal
+  for (; *mask != '\0'; mask++, p++) {
+    if (p >= len) return -1;
+    if (*mask == '9')       { if (!isDigit(buf[p])) return -1; }
+    else if (*mask == 'A')  { if (!isAlpha(buf[p])) return -1; }
+    else if (*mask != buf[p]) return -1;
   }
+  return p;
 }
 
-void LogRip::InsertIP ( IPInfo i, int dest_lev )
+int LogFormat::ScanVariable (int e, const char* buf, int p, int len) const
 {
-  // find records
-  IPMap_iter it;
-  IPInfo info;
-  IPInfo* f = 0x0;
-
-  IPMap_t& list = m_IPList[dest_lev];
+  const FormatElem& el = m_elems[e];
+  int minlen = (el.type == T_NAME) ? 1 : 0;
+  bool greedy = (el.type == T_NAME || el.type == T_PAGE);
+  int q;
+
+  if (e + 1 >= (int) m_elems.size() || isVariable(m_elems[e + 1].type)) {
+    // nothing to anchor on. greedy tokens take the whole run, lazy tokens take the minimum
+    q = p;
+    while (q < len && inClass(el.type, buf[q]) && (greedy || q - p < minlen)) q++;
+    return (q - p >= minlen) ? q : -1;
+  }
 
-  // find or insert
-  it = list.find (i.ip);
-  if (it == list.end()) {
-    it = list.insert(it, std::make_pair(i.ip, info));		
-    f = &(it->second);
-    f->lev = dest_lev;
-    f->score = 0;
-    f->block = 0;
-    f->start_date = i.start_date;
-    f->end_date = i.end_date;
-    f->daily_min_hit = i.daily_min_hit;
-    f->daily_max_hit = i.daily_max_hit;
-    f->daily_min_ppm = i.daily_min_ppm;
-    f->daily_max_ppm = i.daily_max_ppm;
-    f->daily_min_range = i.daily_min_range;
-    f->daily_max_range = i.daily_max_range;
-    f->max_consecutive = i.max_consecutive;
-    f->num_robots = i.num_robots;
-    f->visit_freq = 0;
-    f->visit_time = 0;
-    f->ip_cnt = 0;
-    f->page_cnt = 0;
-    f->uniq_cnt = 0;
-  } else {
-    f = &(it->second);
+  const FormatElem& next = m_elems[e + 1];
+  if (next.type == T_LITERAL && el.type != T_NAME) {
+    // any-char token followed by a literal. jump between candidate first chars
+    const char* lit = next.text.c_str();
+    int litlen = (int) next.text.size();
+    q = p + minlen;
+    while (q + litlen <= len) {
+      const char* c = (const char*) memchr(buf + q, lit[0], len - litlen + 1 - q);
+      if (c == 0x0) return -1;
+      q = int(c - buf);
+      if (memcmp(c, lit, litlen) == 0) return q;
+      q++;
+    }
+    return -1;
   }
-  
-  // update	
-  f->ip = i.ip;
 
-  for (int j=0; j < i.pages.size(); j++) {
-    f->pages.push_back (i.pages[j]);
+  // stop at the first position where the next element matches
+  for (q = p; q <= len; q++) {
+    if (q - p >= minlen && ScanElem(e + 1, buf, q, len) >= 0) return q;
+    if (q == len || !inClass(el.type, buf[q])) return -1;
   }
-  f->page_cnt += i.page_cnt;
-  f->uniq_cnt += i.uniq_cnt;
-  f->ip_cnt += i.ip_cnt;
-  float cnt = f->ip_cnt;
-  f->visit_freq = (f->visit_freq * float(cnt-1) + i.visit_freq)/cnt;
-  f->visit_time = (f->visit_time * float(cnt-1) + i.visit_time)/cnt;
-  f->daily_pages = (f->daily_pages * float(cnt-1) + i.daily_pages)/cnt;
-  if (i.start_date < f->start_date)	f->start_date = i.start_date;
-  if (i.end_date > f->end_date)		f->end_date = i.end_date;
-  if (i.daily_min_hit < f->daily_min_hit)		f->daily_min_hit = i.daily_min_hit;
-  if (i.daily_max_hit > f->daily_max_hit)		f->daily_max_hit = i.daily_max_hit;
-  if (i.daily_min_ppm < f->daily_min_ppm)		f->daily_min_ppm = i.daily_min_ppm;
-  if (i.daily_max_ppm > f->daily_max_ppm)		f->daily_max_ppm = i.daily_max_ppm;
-  if (i.daily_min_range < f->daily_min_range) f->daily_min_range = i.daily_min_range;
-  if (i.daily_max_range > f->daily_max_range) f->daily_max_range = i.daily_max_range;
-  f->elapsed = f->end_date.GetElapsedDays(f->start_date);	
+  return -1;
 }
 
-void LogRip::ConstructSubnet ( int src_lev, int dest_lev )
+int LogFormat::ScanElem (int e, const char* buf, int p, int len) const
 {
-  Vec4F ipv;
-  IPInfo i;	
-  uint32_t mask;
+  const FormatElem& el = m_elems[e];
 
-  IPMap_t& src = m_IPList[src_lev];	
-  mask = getMask(dest_lev);
-  
-  // insert all IPs into parent subnet	
-  std::map<uint32_t, IPInfo>::iterator it;
+  if (el.type == T_LITERAL) {
+    int litlen = (int) el.text.size();
+    if (p + litlen > len || memcmp(buf + p, el.text.c_str(), litlen) != 0) return -1;
+    return p + litlen;
+  }
+  if (isVariable(el.type)) return ScanVariable(e, buf, p, len);
 
-  for (it = src.begin(); it != src.end(); it++) {
-    IPInfo& f = it->second;
-    i = f;
+  return ScanFixed(el.type, buf, p, len);
+}
 
-    // subnet ip		
-    i.ip = getMaskedIP ( f.ip, dest_lev );		
+bool LogFormat::MatchAt (const char* buf, int start, int len, LogMatch& m) const
+{
+  int p = start, end;
 
-    // insert into parent
-    InsertIP (i, dest_lev );
+  for (int e = 0; e < (int) m_elems.size(); e++) {
+    end = ScanElem(e, buf, p, len);
+    if (end < 0) {
+      if (e > m.fail_elem) { m.fail_elem = e; m.fail_col = p; }
+      return false;
+    }
+    if (m_elems[e].group >= 0) {
+      m.caps[ m_elems[e].group ].s = buf + p;
+      m.caps[ m_elems[e].group ].len = end - p;
+    }
+    p = end;
   }
+  return true;
 }
 
+bool LogFormat::Match (const char* buf, int len, LogMatch& m) const
+{
+  // drop line terminators (regex '.' does not match them)
+  while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r')) len--;
+
+  m.caps.resize( m_groups.size() );
+  m.fail_elem = -1;
+  m.fail_col = 0;
+  if (m_elems.empty()) return false;
+
+  // search for the leftmost match, as with regex_search.
+  // a leading wildcard already covers every start position.
+  int last = (m_elems[0].type == T_WILDCARD) ? 0 : len;
+  for (int start = 0; start <= last; start++) {
+    if (m_elems[0].type == T_LITERAL) {
+      const char* c = (const char*) memchr(buf + start, m_elems[0].text[0], len - start);
+      if (c == 0x0) break;
+      start = int(c - buf);
+    }
+    if (MatchAt(buf, start, len, m)) return true;
+  }
+  return false;
+}
 
-void LogRip::CreateImg(int xr, int yr)
+std::string LogFormat::DescribeFailure (const LogMatch& m) const
 {
-  for (int i=0; i < I_NUM; i++)
-    m_img[i].Resize( xr, yr, ImageOp::RGB8 );	
+  if (m.fail_elem < 0) return "Failed to match.";
+
+  const FormatElem& el = m_elems[m.fail_elem];
+  std::string name;
+  switch (el.type) {
+  case T_LITERAL:   name = "literal \"" + el.text + "\""; break;
+  case T_WILDCARD:  name = "wildcard *"; break;
+  default:          name = "token {" + el.text + "}"; break;
+  }
+  return "Failed to match. Expected " + name + " at col " + iToStr(m.fail_col) + ".";
 }
 
-void LogRip::OutputHits ( std::string filename )
-{	
-  FILE* outcsv;	
-  outcsv = fopen(filename.c_str(), "wt");
-  if (outcsv == 0x0) {
-    dbgprintf("ERROR: Unable to open outhits.csv for writing.\n");
-    exit(-1);
+uint64_t ConvertIPv6 ( const char* str, int len )
+{
+  // parse an IPv6 address into its ip key (upper 64 bits), 0 if not valid
+  // - IPv4-mapped addresses (::ffff:1.2.3.4) give the IPv4 key
+  uint16_t grp[8];
+  int num = 0, gap = -1, p = 0;
+  memset ( grp, 0, sizeof(grp) );
+  if (len >= 2 && str[0] == ':' && str[1] == ':') { gap = 0; p = 2; }
+  while (p < len) {
+    int s = p;
+    uint32_t v = 0;
+    while (p < len && isHex(str[p]) && p - s < 5) {
+      v = v * 16 + (isDigit(str[p]) ? str[p] - '0' : (str[p] | 0x20) - 'a' + 10);
+      p++;
+    }
+    if (p < len && str[p] == '.' && num <= 6) {
+      // trailing dotted quad
+      int oct[4], k;
+      for (k = 0, p = s; k < 4; k++) {
+        int d = p;
+        while (p < len && isDigit(str[p]) && p - d < 4) p++;
+        oct[k] = (p == d) ? 999 : parseNum(str + d, p - d);
+        if (oct[k] > 255 || (k < 3 && (p >= len || str[p] != '.'))) return 0;
+        p++;
+      }
+      if (p - 1 != len) return 0;
+      grp[num++] = uint16_t((oct[0] << 8) | oct[1]);
+      grp[num++] = uint16_t((oct[2] << 8) | oct[3]);
+      break;
+    }
+    if (p == s || p - s > 4 || num >= 8) return 0;
+    grp[num++] = uint16_t(v);
+    if (p == len) break;
+    if (str[p] != ':') return 0;
+    p++;
+    if (p < len && str[p] == ':') {
+      if (gap >= 0) return 0;       // one :: only
+      gap = num;
+      p++;
+    } else if (p == len) return 0;
+  }
+  // expand ::
+  if (gap >= 0) {
+    if (num >= 8) return 0;
+    int shift = 8 - num;
+    for (int g = num - 1; g >= gap; g--) { grp[g + shift] = grp[g]; grp[g] = 0; }
+  } else if (num != 8) return 0;
+
+  if (grp[0] == 0 && grp[1] == 0 && grp[2] == 0 && grp[3] == 0 && grp[4] == 0 && grp[5] == 0xFFFF)
+    return (uint64_t(grp[6]) << 16) | grp[7];                 // IPv4-mapped
+  if (grp[0] == 0) return 0;                                  // ::/16 is reserved
+  return (uint64_t(grp[0]) << 48) | (uint64_t(grp[1]) << 32) | (uint64_t(grp[2]) << 16) | grp[3];
+}
+
+bool ConvertIPKey ( const char* str, int len, uint64_t& ip )
+{
+  // parse a dotted quad or IPv6 address into its ip key, with full validation
+  if (memchr ( str, ':', len ) != 0x0) {
+    ip = ConvertIPv6 ( str, len );
+    return ip != 0;
   }
-  // compute starting time
-  int first = 0;
-  float first_tm = 10e10;
-  for (int j=0; j < m_Log.size(); j++) {
-    if ( m_Log[j].date.GetDays() < first_tm) {
-      first = j;
-      first_tm = m_Log[j].date.GetDays();
+  int oct[4], k, p = 0;
+  for (k = 0; k < 4; k++) {
+    int s = p;
+    while (p < len && isDigit(str[p])) p++;
+    if (p == s || p - s > 3) return false;
+    oct[k] = parseNum(str + s, p - s);
+    if (oct[k] > 255) return false;
+    if (k < 3) {
+      if (p >= len || str[p] != '.') return false;
+      p++;
     }
-  }  
-  fprintf ( outcsv, "firstdate, %s\n", m_Log[first].date.WriteDateTime().c_str() );
-    
-  for (int n = 0; n < m_Log.size(); n++) {
-    
-    LogInfo& i = m_Log[n];
-  
-    float tm = i.date.GetDays() - first_tm;
-    Vec4F ipvec = ipToVec(i.ip);
-    float ip = ipvec.x*256 + ipvec.y + (ipvec.z/256.0f);
+  }
+  if (p != len) return false;
+  ip = (uint32_t(oct[0]) << 24) | (uint32_t(oct[1]) << 16) | (uint32_t(oct[2]) << 8) | uint32_t(oct[3]);
+  return true;
+}
 
-    fprintf ( outcsv, "%f, %f\n", tm, ip);
+static void splitFields ( const char* line, std::vector<std::string>& out )
+{
+  // split a csv or tsv line, quoted fields may hold the separator
+  char sep = (strchr ( line, '\t' ) != 0x0) ? '\t' : ',';
+  std::string fld;
+  bool quote = false;
+  out.clear();
+  for (const char* c = line; *c != '\0'; c++) {
+    if (quote) {
+      if (*c != '"')        fld += *c;
+      else if (c[1] == '"') { fld += '"'; c++; }
+      else                  quote = false;
+    } else if (*c == '"') {
+      quote = true;
+    } else if (*c == sep) {
+      out.push_back ( strTrim(fld) );
+      fld.clear();
+    } else if (*c == '\n' || *c == '\r') {
+      break;
+    } else {
+      fld += *c;
+    }
   }
+  out.push_back ( strTrim(fld) );
+}
 
-  fclose(outcsv);
+void GeoDB::Clear ()
+{
+  m_ranges.clear();
+  m_strs.clear();
+  m_strid.clear();
+  Intern ( "" );                        // string 0 = empty
+  GeoRange none = { 0, 0, 0, 0, 0 };
+  m_ranges.push_back ( none );          // range 0 = none
 }
 
-void LogRip::OutputStats(std::string filename, std::string imgname)
+uint32_t GeoDB::Intern (const std::string& str)
 {
-  FILE* outcsv;
-  LogInfo* i;
-  Vec3I actions;
+  std::unordered_map<std::string, uint32_t>::iterator it = m_strid.find ( str );
+  if (it != m_strid.end()) return it->second;
+  uint32_t id = (uint32_t) m_strs.size();
+  m_strs.push_back ( str );
+  m_strid[str] = id;
+  return id;
+}
 
-  outcsv = fopen(filename.c_str(), "wt");
-  if (outcsv == 0x0) {
+void GeoDB::AddRange (uint64_t lo, uint64_t hi, const std::string& asn, const std::string& org, const std::string& country)
+{
+  // asn as "AS15169" or "15169". asn 0 is unrouted space
+  const char* a = asn.c_str();
+  if ((a[0] | 0x20) == 'a' && (a[1] | 0x20) == 's') a += 2;
+  GeoRange r;
+  r.lo = lo;
+  r.hi = hi;
+  r.asn = (uint32_t) strtoul ( a, 0x0, 10 );
+  if (r.asn == 0 || hi < lo || isIPv6(lo) != isIPv6(hi)) return;
+
+  // org names go into unquoted csv output
+  std::string name = org;
+  std::replace ( name.begin(), name.end(), ',', ' ' );
+  r.org = Intern ( name );
+  r.country = Intern ( country );
+  m_ranges.push_back ( r );
+}
+
+bool GeoDB::Load (std::string filename)
+{
+  FILE* fp = fopen ( filename.c_str(), "rt" );
+  if (fp == 0x0) return false;
+  Clear();
+
+  char line[4096];
+  std::vector<std::string> f;
+  uint64_t lo, hi;
+  while (fgets ( line, sizeof(line), fp )) {
+    if (line[0] == '#') continue;
+    splitFields ( line, f );
+    size_t slash = f[0].find ( '/' );
+
+    if (slash != std::string::npos && f.size() >= 2) {
+      // cidr row: network, asn, org [, country]
+      if (!ConvertIPKey ( f[0].c_str(), (int) slash, lo )) continue;
+      int bits = strToI ( f[0].substr ( slash + 1 ) );
+      if (f[0].find(':') != std::string::npos && !isIPv6(lo)) bits -= 96;     // IPv4-mapped
+      int span = (isIPv6(lo) ? 64 : 32) - bits;                                // host bits in the key
+      uint64_t host = (span <= 0) ? 0 : (span >= 64) ? ~0ULL : (1ULL << span) - 1;
+      lo &= ~host;
+      AddRange ( lo, lo | host, f[1], (f.size() > 2) ? f[2] : "", (f.size() > 3) ? f[3] : "" );
+
+    } else if (f.size() >= 5 && ConvertIPKey ( f[0].c_str(), (int) f[0].size(), lo ) && ConvertIPKey ( f[1].c_str(), (int) f[1].size(), hi )) {
+      // range row: start, end, asn, country, org
+      AddRange ( lo, hi, f[2], f[4], f[3] );
+    }
+    // anything else is a header
+  }
+  fclose ( fp );
+
+  // sort by start, drop any range overlapping the one before
+  std::sort ( m_ranges.begin() + 1, m_ranges.end(), [](const GeoRange& a, const GeoRange& b) { return a.lo < b.lo; } );
+  size_t j = 1;
+  for (size_t n = 1; n < m_ranges.size(); n++) {
+    if (j > 1 && m_ranges[n].lo <= m_ranges[j-1].hi) continue;
+    m_ranges[j++] = m_ranges[n];
+  }
+  m_ranges.resize ( j );
+  return true;
+}
+
+void GeoDB::Annotate (IPTable& list, int lev)
+{
+  // list and ranges are both sorted by ip key, so one cursor walks the ranges once
+  // - a subnet gets a range only if the whole subnet is inside it
+  size_t c = 1;
+  for (size_t n = 0; n < list.size(); n++) {
+    IPInfo& f = list[n];
+    uint64_t last = f.ip | ~getMask ( f.ip, lev );
+    while (c < m_ranges.size() && m_ranges[c].hi < f.ip) c++;
+    f.geo = (c < m_ranges.size() && m_ranges[c].lo <= f.ip && last <= m_ranges[c].hi) ? int(c) : 0;
+  }
+}
+
+char ConvertToLog ( LogInfo& li, char typ, const char* str, int len, PageTable& pages )
+{
+  // spans have already been validated by the token grammar
+  int day, mo, yr, hr, min, sec;
+  int oct[4], k, p;
+
+  switch (typ) {
+  case T_IP:
+    if (memchr ( str, ':', len ) != 0x0) {
+      li.ip = ConvertIPv6 ( str, len );
+      if (li.ip == 0) return 'i';
+      break;
+    }
+    for (k = 0, p = 0; k < 4; k++) {
+      int s = p;
+      while (p < len && str[p] != '.') p++;
+      oct[k] = (p - s > 3) ? 999 : parseNum(str + s, p - s);
+      p++;
+      if (oct[k] > 255) {
+        li.ip = 0;
+        return 'i';
+      }
+    }
+    li.ip = (uint32_t(oct[0]) << 24) | (uint32_t(oct[1]) << 16) | (uint32_t(oct[2]) << 8) | uint32_t(oct[3]);
+    break;
+  case T_DATE_DDMMMYY:                  // DD/MMM/YYYY
+    day = parseNum(str, 2);
+    for (mo = 0; mo < 12 && memcmp(str + 3, monthNames[mo], 3) != 0; mo++);
+    if (mo == 12) return 'd';
+    yr = parseNum(str + 7, 4);
+    if (day < 1 || day > 31) return 'd';
+    li.time = packDate (yr, mo + 1, day) + li.time % SEC_PER_DAY;
+    break;
+  case T_DATE_YYYY_MM_DD:               // YYYY-MM-DD
+    yr = parseNum(str, 4);
+    mo = parseNum(str + 5, 2);
+    day = parseNum(str + 8, 2);
+    if (mo < 1 || mo > 12 || day < 1 || day > 31) return 'd';
+    li.time = packDate (yr, mo, day) + li.time % SEC_PER_DAY;
+    break;
+  case T_TIME_HHMMSS:                   // HH:MM:SS
+    hr = parseNum(str, 2);
+    min = parseNum(str + 3, 2);
+    sec = parseNum(str + 6, 2);
+    li.time = dayStart(li.time) + hr * 3600 + min * 60 + sec;
+    break;
+  case T_PAGE:
+    li.page = pages.Intern(str, len);
+    break;
+  };
+  return 1;
+}
+
+bool MappedFile::Open (std::string filename)
+{
+  Close ();
+
+  #ifdef _WIN32
+    hfile = CreateFileA ( filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0x0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0x0 );
+    if (hfile == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(hfile, &sz) || sz.QuadPart == 0) { CloseHandle(hfile); return false; }
+    hmap = CreateFileMappingA ( hfile, 0x0, PAGE_READONLY, 0, 0, 0x0 );
+    if (hmap == 0x0) { CloseHandle(hfile); return false; }
+    data = (const char*) MapViewOfFile ( hmap, FILE_MAP_READ, 0, 0, 0 );
+    if (data == 0x0) { CloseHandle(hmap); CloseHandle(hfile); return false; }
+    size = (size_t) sz.QuadPart;
+  #else
+    int fd = open ( filename.c_str(), O_RDONLY );
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { close(fd); return false; }
+    void* p = mmap ( 0x0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close ( fd );                         // mapping remains valid
+    if (p == MAP_FAILED) return false;
+    madvise ( p, st.st_size, MADV_SEQUENTIAL );
+    data = (const char*) p;
+    size = (size_t) st.st_size;
+  #endif
+  return true;
+}
+
+void MappedFile::Close ()
+{
+  if (data == 0x0) return;
+  #ifdef _WIN32
+    UnmapViewOfFile ( data );
+    CloseHandle ( hmap );
+    CloseHandle ( hfile );
+  #else
+    munmap ( (void*) data, size );
+  #endif
+  data = 0x0;
+  size = 0;
+}
+
+LogStream::LogStream ()
+{
+  fp = 0x0;
+  type = LOG_PLAIN;
+  in_size = 0;
+  in_pos = 0;
+  #ifdef BUILD_ZLIB
+    gz = 0x0;
+  #endif
+  #ifdef BUILD_ZSTD
+    zs = 0x0;
+  #endif
+}
+
+int LogStream::getType (std::string filename)
+{
+  unsigned char m[4] = {0, 0, 0, 0};
+  FILE* f = fopen ( filename.c_str(), "rb" );
+  if (f == 0x0) return LOG_PLAIN;
+  size_t n = fread ( m, 1, 4, f );
+  fclose ( f );
+  if (n >= 2 && m[0] == 0x1F && m[1] == 0x8B) return LOG_GZIP;
+  if (n == 4 && m[0] == 0x28 && m[1] == 0xB5 && m[2] == 0x2F && m[3] == 0xFD) return LOG_ZSTD;
+  return LOG_PLAIN;
+}
+
+bool LogStream::Open (std::string filename)
+{
+  type = getType ( filename );
+  fp = fopen ( filename.c_str(), "rb" );
+  if (fp == 0x0) return false;
+  in_pos = 0;
+  in_size = 0;
+  if (fseek64 ( fp, 0, SEEK_END ) == 0) {
+    in_size = ftell64 ( fp );
+    fseek64 ( fp, 0, SEEK_SET );
+  }
+  switch (type) {
+  case LOG_GZIP:
+    #ifdef BUILD_ZLIB
+      // zlib reads from its own descriptor. concatenated gzip members are read as one
+      fclose ( fp );
+      fp = 0x0;
+      gz = gzopen ( filename.c_str(), "rb" );
+      if (gz == 0x0) return false;
+      gzbuffer ( gz, 1 << 20 );
+      return true;
+    #else
+      printf ( "**** ERROR: %s is gzip compressed. Build with BUILD_ZLIB to read it.\n", filename.c_str() );
+      Close ();
+      return false;
+    #endif
+  case LOG_ZSTD:
+    #ifdef BUILD_ZSTD
+      zs = ZSTD_createDStream ();
+      ZSTD_initDStream ( zs );
+      zbuf.resize ( ZSTD_DStreamInSize() );
+      zin.src = &zbuf[0];
+      zin.size = 0;
+      zin.pos = 0;
+      zin_end = false;
+      return true;
+    #else
+      printf ( "**** ERROR: %s is zstd compressed. Build with BUILD_ZSTD to read it.\n", filename.c_str() );
+      Close ();
+      return false;
+    #endif
+  }
+  return true;
+}
+
+size_t LogStream::Read (char* buf, size_t len)
+{
+  size_t n = 0;
+  switch (type) {
+  case LOG_PLAIN:
+    n = fread ( buf, 1, len, fp );
+    in_pos += n;
+    break;
+  #ifdef BUILD_ZLIB
+  case LOG_GZIP: {
+    int r = gzread ( gz, buf, (unsigned int) std::min ( len, size_t(1 << 30) ) );
+    if (r < 0) {
+      int err;
+      printf ( "**** ERROR: gzip read failed. %s\n", gzerror ( gz, &err ) );
+      return 0;
+    }
+    n = r;
+    in_pos = gzoffset ( gz );
+    } break;
+  #endif
+  #ifdef BUILD_ZSTD
+  case LOG_ZSTD: {
+    // decompress until the output is full or the input ends. frames may be concatenated
+    ZSTD_outBuffer out = { buf, len, 0 };
+    while (out.pos < out.size) {
+      if (zin.pos == zin.size && !zin_end) {
+        zin.size = fread ( &zbuf[0], 1, zbuf.size(), fp );
+        zin.pos = 0;
+        in_pos += zin.size;
+        zin_end = (zin.size == 0);
+      }
+      size_t prev = out.pos;
+      size_t r = ZSTD_decompressStream ( zs, &out, &zin );
+      if (ZSTD_isError(r)) {
+        printf ( "**** ERROR: zstd read failed. %s\n", ZSTD_getErrorName(r) );
+        break;
+      }
+      if (zin_end && out.pos == prev) break;      // input done and flushed
+    }
+    n = out.pos;
+    } break;
+  #endif
+  }
+  return n;
+}
+
+void LogStream::Close ()
+{
+  #ifdef BUILD_ZLIB
+    if (gz != 0x0) gzclose ( gz );
+    gz = 0x0;
+  #endif
+  #ifdef BUILD_ZSTD
+    if (zs != 0x0) ZSTD_freeDStream ( zs );
+    zs = 0x0;
+  #endif
+  if (fp != 0x0) fclose ( fp );
+  fp = 0x0;
+  type = LOG_PLAIN;
+}
+
+int LogRip::getThreads ()
+{
+  // threads: 0 = use all cores
+  int n = getI(CONF_THREADS);
+  if (n <= 0) n = (int) std::thread::hardware_concurrency();
+  return (n <= 0) ? 1 : n;
+}
+
+void LogRip::ParseChunk (const LogFormat& fmt, LogChunk& chunk, bool debug_parse)
+{
+  std::string reason;
+  LogMatch match;
+  LogInfo li;
+  char ret, c;
+
+  const char* p = chunk.data;
+  const char* end = chunk.data + chunk.len;
+  const char* nl;
+  int len;
+
+  chunk.hits = 0;
+  chunk.skipped = 0;
+
+  while (p < end) {
+
+    // next line
+    nl = (const char*) memchr ( p, '\n', end - p );
+    if (nl == 0x0) nl = end;
+    len = int(nl - p);
+
+    if (debug_parse) printf("\n===== %.*s\n", len, p);
+
+    // clear parsing 
+    li.clear();				
+    ret = 1;
+    
+    // parse this line
+    bool matched = fmt.Match ( p, len, match );
+
+    // process results
+    if (matched) {
+      for (int n = 0; n < fmt.NumGroups(); n++) {
+        c = ConvertToLog (li, fmt.GroupType(n), match.caps[n].s, match.caps[n].len, chunk.pages );
+        if (c != 1) ret = c;
+      }
+    }
+    
+    // add item to log (if valid)
+    if (ret == 1 && li.isValid()) {
+      if (debug_parse) printf("   OK. LOG: DATE=%s, IP=%s, PAGE=%s\n", writeTime(li.time).c_str(), ipToStr(li.ip, getBits(li.ip, SUB_D)).c_str(), chunk.pages.getStr(li.page));
+      chunk.log.push_back(li);
+      chunk.hits++;
+
+    }	else {
+      chunk.skipped++;
+      if (debug_parse) {
+        if (!matched) reason = fmt.DescribeFailure ( match );
+        else if (ret == 'i') reason = "IP not valid.";
+        else if (ret == 'd') reason = "Date not handled (invalid day or month).";
+        else if (li.ip == 0) reason = "No IP found.";
+        else if (li.time < SEC_PER_DAY) reason = "No date found.";
+        else if (li.page == 0) reason = "No page found."; 
+        printf("   SKIPPED. Reason: %s\n", reason.c_str() );
+      }
+    }
+    p = nl + 1;
+  }
+}
+
+bool LogRip::ReportProgress (LoadProgress& prog)
+{
+  // report percentage complete, every 5%
+  if (prog.total == 0) return true;
+  long perc = long( (prog.done * 100) / prog.total );
+  long hits = prog.hits, skipped = prog.skipped;
+  if (perc / 5 != prog.percl / 5) {
+    prog.percl = perc;
+    printf ( " %ld%%. %ld read, %ld skipped.\n", perc - perc % 5, hits, skipped );
+    if (skipped > hits && hits==0) return false;      // nothing parsed, format issue
+  }
+  return true;
+}
+
+void LogRip::ParseBlock (const LogFormat& fmt, const char* data, size_t len, LoadProgress& prog)
+{
+  bool debug_parse = getB(CONF_DEBUGPARSE);
+  int num_threads = debug_parse ? 1 : getThreads();     // debug output stays in order
+
+  // split block into newline-aligned chunks, ~1% of input each (256 KB to 8 MB)
+  size_t chunk_size = std::max ( size_t(256 << 10), std::min ( size_t(8 << 20), len / 100 ) );
+  std::vector<LogChunk> chunks;
+  LogChunk ch;
+  size_t s = 0, e;
+  ch.hits = ch.skipped = 0;
+
+  while (s < len) {
+    e = std::min ( s + chunk_size, len );
+    if (e < len) {
+      const char* nl = (const char*) memchr ( data + e, '\n', len - e );
+      e = (nl == 0x0) ? len : size_t(nl - data) + 1;
+    }
+    ch.data = data + s;
+    ch.len = e - s;
+    chunks.push_back ( ch );
+    s = e;
+  }
+  int num = (int) chunks.size();
+  if (num == 0) return;
+  if (num_threads > num) num_threads = num;
+
+  std::unique_ptr< std::atomic<bool>[] > ready ( new std::atomic<bool>[num] );
+  for (int c = 0; c < num; c++) ready[c] = false;
+  std::atomic<int> next (0);
+  std::atomic<bool> stop (false);
+
+  // parse chunks on worker threads, each into its own hit buffer
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; t++) {
+    workers.push_back ( std::thread ( [&]() {
+      int c;
+      while ( !stop && (c = next++) < num ) {
+        double t = m_Prof.StepStart();
+        ParseChunk ( fmt, chunks[c], debug_parse );
+        m_Prof.Step ( STEP_MATCH, t, chunks[c].hits + chunks[c].skipped );
+        prog.hits += chunks[c].hits;
+        prog.skipped += chunks[c].skipped;
+        prog.done += chunks[c].len;
+        ready[c] = true;
+      }
+    }));
+  }
+
+  // merge finished chunks into the log, in input order
+  std::vector<uint32_t> remap;
+  int merged = 0;
+  while (merged < num) {
+    if (!ReportProgress ( prog )) { stop = true; break; }
+    if (!ready[merged]) {
+      std::this_thread::sleep_for ( std::chrono::milliseconds(2) );
+      continue;
+    }
+    // remap chunk page ids into the global page table
+    double t = m_Prof.StepStart();
+    std::vector<LogInfo>& log = chunks[merged].log;
+    m_Pages.Merge ( chunks[merged].pages, remap );
+    for (size_t n = 0; n < log.size(); n++) log[n].page = remap[ log[n].page ];
+    m_Log.insert ( m_Log.end(), log.begin(), log.end() );
+    m_Prof.Step ( STEP_MERGE, t, log.size() );
+    std::vector<LogInfo>().swap ( log );
+    chunks[merged].pages = PageTable();
+    merged++;
+  }
+  for (int t = 0; t < num_threads; t++) workers[t].join();
+
+  if (stop) {
+    printf ("*** ERROR: Log not read. Likely a format issue.\n");
+    printf ("Be sure that the format string in your .conf matches the log input.\n");
+    printf ("See logrip instructions. You can also set debugparse=1 to test format strings.\n");
+    printf ("STOPPED.\n");
+    exit(-7);
+  }
+}
+
+void LogRip::LoadLogs (std::vector<std::string>& files, size_t from, bool live)
+{
+  // load one or more logs as a single log. 'from' skips the start of a single log (snapshot)
+  // - on a 'live' last log, a line still being written is left for the next read
+  std::vector<size_t> file_start;
+  for (size_t f = 0; f < files.size(); f++) {
+    file_start.push_back ( m_Log.size() );
+    LoadLog ( files[f], (files.size() == 1) ? from : 0, live && f + 1 == files.size() );
+  }
+
+  if (m_Log.size() == 0) {
+    printf ("**** ERROR: No logs found. Log format may be different.\n");
+    exit(-2);
+  }	
+
+  if (files.size() > 1) MergeLogs ( file_start );
+
+  // order pages by name
+  double t = m_Prof.StepStart();
+  m_Pages.BuildRanks ();
+  m_Prof.Step ( STEP_SORT, t, m_Pages.Count() );
+}
+
+void LogRip::MergeLogs (std::vector<size_t>& file_start)
+{
+  // put the hits of several files in time order, as one log
+  // - rotated logs don't overlap, so whole files are ordered by their earliest hit
+  // - files that do overlap (e.g. several servers) are then merged by time
+  size_t num = file_start.size();
+  file_start.push_back ( m_Log.size() );
+  std::vector<int> order;
+  std::vector<uint32_t> first_tm ( num, 0 );
+  for (size_t f = 0; f < num; f++) {
+    if (file_start[f] == file_start[f+1]) continue;
+    first_tm[f] = m_Log[ file_start[f] ].time;
+    for (size_t n = file_start[f]; n < file_start[f+1]; n++) first_tm[f] = std::min ( first_tm[f], m_Log[n].time );
+    order.push_back ( f );
+  }
+  std::stable_sort ( order.begin(), order.end(), [&first_tm](int a, int b) { return first_tm[a] < first_tm[b]; } );
+
+  std::vector<LogInfo> log;
+  std::vector<size_t> run_start ( 1, 0 );
+  log.reserve ( m_Log.size() );
+  for (size_t k = 0; k < order.size(); k++) {
+    log.insert ( log.end(), m_Log.begin() + file_start[ order[k] ], m_Log.begin() + file_start[ order[k]+1 ] );
+    run_start.push_back ( log.size() );
+  }
+  m_Log.swap ( log );
+
+  auto earlier = [](const LogInfo& a, const LogInfo& b) { return a.time < b.time; };
+  bool by_time = std::is_sorted ( m_Log.begin(), m_Log.end(), earlier );
+  if (!by_time) {
+    // k-way merge of the files, each put in time order first (radix sort, if not already)
+    // - ties go to the earlier file, the same order as a stable sort of the whole log
+    double t = m_Prof.StepStart();
+    size_t runs = run_start.size() - 1;
+    for (size_t r = 0; r < runs; r++) {
+      if (!std::is_sorted ( m_Log.begin() + run_start[r], m_Log.begin() + run_start[r+1], earlier ))
+        sortHits ( m_Log, run_start[r], run_start[r+1], false, getThreads() );
+    }
+    std::vector<size_t> pos ( run_start.begin(), run_start.end() - 1 );
+    auto later = [&](size_t a, size_t b) {
+      uint32_t ta = m_Log[ pos[a] ].time, tb = m_Log[ pos[b] ].time;
+      return (ta != tb) ? (ta > tb) : (a > b);
+    };
+    std::vector<size_t> heap;
+    for (size_t r = 0; r < runs; r++) if (run_start[r] < run_start[r+1]) heap.push_back ( r );
+    std::make_heap ( heap.begin(), heap.end(), later );
+    log.clear ();
+    while (!heap.empty()) {
+      std::pop_heap ( heap.begin(), heap.end(), later );
+      size_t r = heap.back();
+      log.push_back ( m_Log[ pos[r]++ ] );
+      if (pos[r] == run_start[r+1]) heap.pop_back();
+      else std::push_heap ( heap.begin(), heap.end(), later );
+    }
+    m_Log.swap ( log );
+    m_Prof.Step ( STEP_SORT, t, m_Log.size() );
+  }
+  if (order.size() > 1) printf ( "Merged %d logs by time%s.\n", (int) order.size(), by_time ? "" : " (overlapping)" );
+}
+
+void LogRip::LoadLog (std::string filename, size_t from, bool live)
+{
+  // compile the log format once
+  // std::string format = "{X.X.X.X} {AAA} {AAA} [{DD/MMM/YYYY}:{HH:MM:SS} +{NNN}] \"{GET} {PAGE}HTTP/*\" {RETURN} {BYTES} \"*\" {PLATFORM}";
+  // std::string format = "* Started {GET} \"{PAGE}\" for {X.X.X.X} at {YYYY-MM-DD} {HH:MM:SS}";
+  LogFormat fmt;
+  fmt.Compile ( getStr( CONF_FORMAT ) );
+
+  LoadProgress prog;
+  prog.total = 0;
+  prog.percl = 0;
+  prog.done = 0;
+  prog.hits = 0;
+  prog.skipped = 0;
+
+  MappedFile mf;
+  if (LogStream::getType ( filename ) == LOG_PLAIN && mf.Open ( filename )) {
+
+    // memory-mapped. parse the whole file (or the part after 'from') in parallel chunks
+    // - a live log is parsed up to its last complete line, the rest is read on resume or by FollowLog
+    from = std::min ( from, mf.size );
+    printf ( "Reading log: %s (%d threads)\n", filename.c_str(), getB(CONF_DEBUGPARSE) ? 1 : getThreads() );
+    if (from > 0) printf ( " Skipping %llu bytes already in snapshot.\n", (unsigned long long) from );
+    size_t end = mf.size;
+    if (live) {
+      while (end > from && mf.data[end-1] != '\n') end--;
+    }
+    prog.total = end - from;
+    ParseBlock ( fmt, mf.data + from, end - from, prog );
+    m_log_pos = end;
+    mf.Close ();
+
+  } else {
+
+    // compressed or not mappable (pipe, special or empty file). stream in blocks
+    // - a reader thread fills (and decompresses) the next blocks while the current one is parsed
+    LogStream in;
+    if (!in.Open ( filename )) {
+      printf ( "ERROR: Unable to open %s\n", filename.c_str() );
+      return;
+    }
+    printf ( "Reading log: %s%s\n", filename.c_str(), (in.type == LOG_GZIP) ? " (gzip)" : (in.type == LOG_ZSTD) ? " (zstd)" : "" );
+
+    const size_t block_size = 16 << 20;
+    std::vector<char> buf ( block_size );
+    size_t have = 0, cut, n;
+    for (n = 0; n < from; n += cut) {
+      if ((cut = in.Read ( &buf[0], std::min ( block_size, from - n ) )) == 0) break;
+    }
+    if (in.type == LOG_PLAIN) prog.total = (in.in_size > from) ? size_t(in.in_size - from) : 0;
+    m_log_pos = n;
+
+    struct Block {
+      std::vector<char> data;
+      uint64_t          in_pos;
+    };
+    std::deque<Block> queue;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool eof = false;
+
+    std::thread reader ( [&]() {
+      for (;;) {
+        Block b;
+        b.data.resize ( block_size );
+        b.data.resize ( in.Read ( &b.data[0], block_size ) );
+        b.in_pos = in.in_pos;
+        std::unique_lock<std::mutex> lock ( mtx );
+        cv.wait ( lock, [&]() { return queue.size() < 2; } );     // keep at most two blocks ahead
+        if (b.data.empty()) { eof = true; cv.notify_all(); break; }
+        queue.push_back ( std::move(b) );
+        cv.notify_all ();
+      }
+    });
+
+    uint64_t out_pos = 0;
+    for (;;) {
+      Block b;
+      b.in_pos = 0;
+      {
+        std::unique_lock<std::mutex> lock ( mtx );
+        cv.wait ( lock, [&]() { return !queue.empty() || eof; } );
+        if (!queue.empty()) { b = std::move ( queue.front() ); queue.pop_front(); }
+        cv.notify_all ();
+      }
+      // append to the unparsed tail
+      n = b.data.size();
+      if (have + n > buf.size()) buf.resize ( have + n );
+      if (n > 0) memcpy ( &buf[0] + have, &b.data[0], n );
+      have += n;
+      if (have == 0) break;
+
+      // estimate uncompressed size from the compressed bytes read so far
+      out_pos += n;
+      if (in.type != LOG_PLAIN && b.in_pos > 0) prog.total = size_t( double(out_pos) * in.in_size / b.in_pos );
+
+      // parse up to the last complete line (everything at eof, except on a live log)
+      cut = have;
+      if (n > 0 || live) {
+        while (cut > 0 && buf[cut-1] != '\n') cut--;
+        if (cut == 0 && n > 0) continue;        // line longer than block
+      }
+      ParseBlock ( fmt, &buf[0], cut, prog );
+      m_log_pos += cut;
+      memmove ( &buf[0], &buf[0] + cut, have - cut );
+      have -= cut;
+      if (n == 0) break;
+    }
+    reader.join ();
+  }
+
+  printf("\n" );
+}
+
+
+uint64_t hashBytes (const char* data, size_t len, uint64_t h = 14695981039346656037ULL)
+{
+  // FNV-1a
+  for (size_t n = 0; n < len; n++) {
+    h ^= (unsigned char) data[n];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint64_t hashLogStart (std::string logfile, uint64_t len)
+{
+  // hash of the first bytes of the log (up to 1 MB), 0 if the log is shorter than len
+  FILE* fp = fopen ( logfile.c_str(), "rb" );
+  if (fp == 0x0) return 0;
+  std::vector<char> buf ( std::min ( len, uint64_t(1 << 20) ) );
+  size_t n = buf.empty() ? 0 : fread ( &buf[0], 1, buf.size(), fp );
+  fseek64 ( fp, 0, SEEK_END );
+  uint64_t size = ftell64 ( fp );
+  fclose ( fp );
+  if (n < buf.size() || size < len) return 0;
+  return hashBytes ( buf.empty() ? "" : &buf[0], n ) ^ len;
+}
+
+uint64_t LogRip::getPolicyHash ()
+{
+  // settings that change metrics, scores or blocks
+  uint64_t h = hashBytes ( "", 0 );
+  for (int k = CONF_REASONS + 1; k <= CONF_MAX_DAILY_PPM; k++) {
+    const Value& v = m_Config[k].val;
+    char buf[64];
+    if (v.type == ValueType::FLOAT) snprintf ( buf, 64, "%d=%.9g;", k, v.f );
+    else                            snprintf ( buf, 64, "%d=%d;", k, v.i );
+    h = hashBytes ( buf, strlen(buf), h );
+  }
+  h = hashBytes ( getB(CONF_ROLLING) ? "rolling" : "", getB(CONF_ROLLING) ? 7 : 0, h );
+  h = hashBytes ( getB(CONF_SKETCH) ? "sketch" : "", getB(CONF_SKETCH) ? 6 : 0, h );
+  h = hashBytes ( (const char*) subnet_bits, sizeof(subnet_bits), h );
+  return hashBytes ( (const char*) subnet_bits6, sizeof(subnet_bits6), h );
+}
+
+int LogRip::LoadSnapshot (std::string snapfile, std::string logfile)
+{
+  // load a snapshot of a previous run
+  // returns 0 = not used, 1 = hits & pages loaded, 2 = hits, pages & IP levels loaded
+  MappedFile mf;
+  SnapHeader h;
+  if (!mf.Open ( snapfile ) || mf.size < sizeof(SnapHeader)) return 0;
+  memcpy ( &h, mf.data, sizeof(SnapHeader) );
+
+  printf ( "Reading snapshot: %s\n", snapfile.c_str() );
+  std::string fmt = getStr( CONF_FORMAT );
+  if (memcmp ( h.magic, "LOGRIPSS", 8 ) != 0 || h.version != SNAP_VERSION ||
+      h.hit_size != sizeof(LogInfo) || h.ip_size != sizeof(IPInfo)) {
+    printf ( " Snapshot version or platform differs. Ignored.\n" );
+    return 0;
+  }
+  if (h.fmt_hash != hashBytes ( fmt.c_str(), fmt.size() )) {
+    printf ( " Snapshot was made with a different format. Ignored.\n" );
+    return 0;
+  }
+  if (h.log_hash != hashLogStart ( logfile, h.log_pos )) {
+    printf ( " Log does not continue the snapshot (replaced or rotated). Ignored.\n" );
+    return 0;
+  }
+  // check sections
+  bool ok = (h.off_hits + h.num_hits * sizeof(LogInfo) <= mf.size) && (h.off_pages <= h.off_ips[0]) && h.base_hits <= h.num_hits;
+  for (int lev = 0; lev < SUB_MAX; lev++) {
+    ok &= (h.off_ips[lev] + h.num_ips[lev] * sizeof(IPInfo) <= mf.size);
+    if (h.off_uniq[lev] != 0) ok &= (h.off_uniq[lev] + h.num_ips[lev] * sizeof(UniqSketch) <= mf.size);
+    if (h.off_rate[lev] != 0) ok &= (h.off_rate[lev] + h.num_ips[lev] * sizeof(RateState) <= mf.size);
+  }
+  if (!ok || !m_Pages.Read ( mf.data + h.off_pages, h.off_ips[0] - h.off_pages )) {
+    printf ( " Snapshot is damaged. Ignored.\n" );
+    return 0;
+  }
+
+  // hits & pages
+  m_Log.resize ( h.num_hits );
+  if (h.num_hits > 0) memcpy ( &m_Log[0], mf.data + h.off_hits, h.num_hits * sizeof(LogInfo) );
+  m_base_hits = h.base_hits;
+  m_log_pos = h.log_pos;
+  printf ( " %llu hits, %u pages, %llu log bytes.\n", (unsigned long long) h.num_hits, m_Pages.Count(), (unsigned long long) h.log_pos );
+
+  // IP levels, only if scored with the same settings
+  if (h.policy_hash != getPolicyHash() || h.num_ips[SUB_D] == 0) {
+    printf ( " Scoring settings changed, IPs will be recomputed.\n" );
+    return 1;
+  }
+  for (int lev = 0; lev < SUB_MAX; lev++) {
+    std::vector<IPInfo>& list = m_IPList[lev].getList();
+    list.resize ( h.num_ips[lev] );
+    if (h.num_ips[lev] > 0) memcpy ( &list[0], mf.data + h.off_ips[lev], h.num_ips[lev] * sizeof(IPInfo) );
+    if ( getB(CONF_SKETCH) ) {
+      std::vector<UniqSketch>& uniq = m_IPList[lev].getUniqList();
+      uniq.resize ( h.num_ips[lev] );
+      if (h.num_ips[lev] > 0 && h.off_uniq[lev] != 0) memcpy ( &uniq[0], mf.data + h.off_uniq[lev], h.num_ips[lev] * sizeof(UniqSketch) );
+    }
+    if ( getB(CONF_ROLLING) ) {
+      std::vector<RateState>& rate = m_IPList[lev].getRateList();
+      rate.resize ( h.num_ips[lev] );
+      if (h.num_ips[lev] > 0 && h.off_rate[lev] != 0) memcpy ( &rate[0], mf.data + h.off_rate[lev], h.num_ips[lev] * sizeof(RateState) );
+    }
+  }
+  m_time_min = h.time_min;
+  m_time_max = h.time_max;
+  m_total_days = h.total_days;
+  m_DayList.clear ();
+  for (int d = 0; d < m_total_days; d++) {
+    m_DayList.push_back ( DayInfo( unpackTime(m_time_min + d * SEC_PER_DAY) ) );
+  }
+  // hits after the sorted base
+  std::vector<uint64_t> keys;
+  for (int lev = SUB_D; lev >= SUB_B; lev--) AddDelta ( m_base_hits, lev, keys );
+
+  return 2;
+}
+
+void LogRip::SaveSnapshot (std::string snapfile, std::string logfile)
+{
+  // write to a temp file, then replace
+  std::string tmpfile = snapfile + ".tmp";
+  FILE* fp = fopen ( tmpfile.c_str(), "wb" );
+  if (fp == 0x0) {
+    printf ( "**** ERROR: Unable to write snapshot %s\n", tmpfile.c_str() );
+    return;
+  }
+  SnapHeader h;
+  std::string fmt = getStr( CONF_FORMAT );
+  memset ( &h, 0, sizeof(SnapHeader) );
+  memcpy ( h.magic, "LOGRIPSS", 8 );
+  h.version = SNAP_VERSION;
+  h.hit_size = sizeof(LogInfo);
+  h.ip_size = sizeof(IPInfo);
+  h.total_days = m_total_days;
+  h.time_min = m_time_min;
+  h.time_max = m_time_max;
+  h.log_pos = m_log_pos;
+  h.log_hash = hashLogStart ( logfile, m_log_pos );
+  h.fmt_hash = hashBytes ( fmt.c_str(), fmt.size() );
+  h.policy_hash = getPolicyHash ();
+  h.num_hits = m_Log.size();
+  h.base_hits = m_base_hits;
+
+  char pad[64];
+  memset ( pad, 0, 64 );
+  fwrite ( &h, sizeof(SnapHeader), 1, fp );
+  #define SNAP_ALIGN(off) { uint64_t pos = ftell64(fp); fwrite ( pad, 1, (64 - pos % 64) % 64, fp ); off = ftell64(fp); }
+
+  SNAP_ALIGN ( h.off_hits );
+  if (h.num_hits > 0) fwrite ( &m_Log[0], sizeof(LogInfo), h.num_hits, fp );
+  SNAP_ALIGN ( h.off_pages );
+  m_Pages.Write ( fp );
+  for (int lev = 0; lev < SUB_MAX; lev++) {
+    std::vector<IPInfo>& list = m_IPList[lev].getList();
+    SNAP_ALIGN ( h.off_ips[lev] );
+    h.num_ips[lev] = list.size();
+    if (list.size() > 0) fwrite ( &list[0], sizeof(IPInfo), list.size(), fp );
+  }
+  for (int lev = 0; lev < SUB_MAX && getB(CONF_SKETCH); lev++) {
+    std::vector<UniqSketch>& uniq = m_IPList[lev].getUniqList();
+    SNAP_ALIGN ( h.off_uniq[lev] );
+    if (uniq.size() > 0) fwrite ( &uniq[0], sizeof(UniqSketch), uniq.size(), fp );
+  }
+  for (int lev = 0; lev < SUB_MAX && getB(CONF_ROLLING); lev++) {
+    std::vector<RateState>& rate = m_IPList[lev].getRateList();
+    SNAP_ALIGN ( h.off_rate[lev] );
+    if (rate.size() > 0) fwrite ( &rate[0], sizeof(RateState), rate.size(), fp );
+  }
+  #undef SNAP_ALIGN
+
+  // header with section offsets
+  fseek64 ( fp, 0, SEEK_SET );
+  fwrite ( &h, sizeof(SnapHeader), 1, fp );
+  bool ok = (ferror(fp) == 0);
+  fclose ( fp );
+
+  remove ( snapfile.c_str() );
+  if (!ok || rename ( tmpfile.c_str(), snapfile.c_str() ) != 0) {
+    printf ( "**** ERROR: Unable to write snapshot %s\n", snapfile.c_str() );
+    return;
+  }
+  printf ( "Snapshot saved: %s\n", snapfile.c_str() );
+}
+
+void LogRip::InsertLog ( size_t first, size_t cnt, int lev )
+{
+  // insert the hit range of one IP
+  IPTable& list = m_IPList[ lev ];
+  LogInfo& i = m_Log[first];
+  bool created;
+
+  // ranges arrive in ip order, insert at end
+  IPInfo& f = list.Insert ( i.ip, created );
+  f.lev = lev;
+  f.geo = 0;
+  f.ip_cnt = 1;		
+  f.first = first;
+  f.base_cnt = (int) cnt;
+  f.page_cnt = (int) cnt;
+  f.start_time = i.time;                     // range is sorted by time
+  f.end_time = m_Log[first + cnt - 1].time;
+}
+
+IPInfo* LogRip::FindIP (uint64_t ip, int lev)
+{
+  return m_IPList[lev].Find ( getMaskedIP( ip, lev ) );
+}
+
+
+void LogRip::ConstructIPHash()
+{
+  // sort hits by ip and time. every IP and subnet is then a contiguous range of m_Log
+  SortHitsByIP ();
+  m_base_hits = m_Log.size();
+
+  // Insert IP ranges into D-level IP hash
+  size_t first = 0;
+  for (size_t n = 1; n <= m_Log.size(); n++) {
+    if (n == m_Log.size() || m_Log[n].ip != m_Log[first].ip) {
+      InsertLog ( first, n - first, SUB_D );
+      first = n;
+    }
+  }
+}
+
+void LogRip::PrepareDays()
+{
+  // determine date range of entire dataset
+  IPTable& list = m_IPList[SUB_D];	
+
+  m_time_min = list[0].start_time;
+  m_time_max = list[0].end_time;
+
+  for (size_t n = 0; n < list.size(); n++) {
+    if (list[n].start_time < m_time_min)	m_time_min = list[n].start_time;
+    if (list[n].end_time > m_time_max)		m_time_max = list[n].end_time;
+  }	
+
+  // prepare days structure
+  m_time_min = dayStart(m_time_min);
+  m_time_max = dayStart(m_time_max) + SEC_PER_DAY - 1;
+  m_total_days = elapsedDays(m_time_max, m_time_min) + 1;
+
+  dbgprintf ( "  Start date: %s\n", writeTime(m_time_min).c_str() );
+  dbgprintf ( "  End date:   %s\n", writeTime(m_time_max).c_str() );
+  dbgprintf ( "  Total days: %d\n", m_total_days );
+  
+  // prepare memory for days
+  for (int d = 0; d < m_total_days; d++) {
+    m_DayList.push_back ( DayInfo( unpackTime(m_time_min + d * SEC_PER_DAY) ) );
+  }
+}
+
+void LogRip::ComputeDailyMetrics ( IPInfo* f, const std::vector<size_t>& order )
+{
+  // daily metrics
+  // - num_robots				all accesses to robots.txt
+  // - max_consecutive	maximum consecutive days	
+  // - elapsed					num elapsed days
+  // - daily_min_hit		lowest hits per day
+  // - daily_max_hit		highest hits per day  
+  // - daily_min_ppm		lowest daily pages/min
+  // - daily_max_ppm		highest daily pages/min
+  // - daily_min_range	lowest daily range (start to end in hours)
+  // - daily_max_range	highest daily range (start to end in hours)
+  //
+  // order is the IP's hits sorted by time, so each active day is one run of it.
+  // only active days are visited, days without hits cost nothing.
+    
+  LogInfo p, pl;
+  int consecutive = 0;
+  int d, prev_d = -2;
+  size_t j, k;
+  int daily_hits;
+  float ave_ppm, range, ave_hits, gap;
+  float dt;
+
+  f->max_consecutive = 1;
+  f->daily_min_hit = 1e7;
+  f->daily_max_hit = 0;
+  f->daily_min_ppm = 1e7;
+  f->daily_max_ppm = 0;
+  f->daily_min_range = 1440;
+  f->daily_max_range = 0;
+  f->num_robots = 0;
+  f->num_days = 0;
+  f->daily_ave_hit = 0;
+
+  ave_hits = 0;
+
+  for (j = 0; j < order.size(); j = k) {
+
+    // find the hits of this day, order[j..k)
+    d = elapsedDays ( m_Log[order[j]].time, m_time_min );
+    for (k = j + 1; k < order.size() && elapsedDays ( m_Log[order[k]].time, m_time_min ) == d; k++);
+
+    assert( d >= 0 && d < m_total_days );
+
+    // count consecutive pages
+    if (d==0 || d == prev_d + 1 ) consecutive++; else consecutive = 0;
+    if (consecutive > f->max_consecutive) f->max_consecutive = consecutive;
+    prev_d = d;
+
+    // get daily metrics
+    daily_hits = int(k - j); 
+    p = m_Log[ order[k-1] ];
+    pl = m_Log[ order[j] ];			
+    range = elapsedMin ( p.time, pl.time );		// range in minutes
+    ave_hits += daily_hits;
+    f->num_days++;
+    
+    // get each pages for: robot cnt, time deltas			
+    ave_ppm = 0;
+    gap = 0;
+    for (size_t i = j; i < k; i++) {
+      p = m_Log[ order[i] ];
+      if (m_Pages.isRobots(p.page)) f->num_robots++;				
+      if (i > j) {
+        dt = elapsedMin (p.time, pl.time);
+        ave_ppm += dt;
+        if (dt > gap) gap = dt;
+      }				
+      pl = p;				
+    }
+    ave_ppm = (daily_hits==1) ? 0 : (daily_hits - 1) / ave_ppm;
+
+    range -= gap;
+
+    // find metric min/max for each day
+    if (daily_hits < f->daily_min_hit)	f->daily_min_hit = daily_hits;
+    if (daily_hits > f->daily_max_hit)	f->daily_max_hit = daily_hits;
+    if (daily_hits >= 3 ) {
+        if (ave_ppm < f->daily_min_ppm) f->daily_min_ppm = ave_ppm;
+        if (ave_ppm > f->daily_max_ppm) f->daily_max_ppm = ave_ppm;
+        if (range < f->daily_min_range) f->daily_min_range = range;
+        if (range > f->daily_max_range) f->daily_max_range = range;				
+    }
+  }
+
+  if (f->daily_min_hit == 1e7) f->daily_min_hit = 0;	
+  if (f->daily_min_ppm == 1e7) f->daily_min_ppm = 0;
+  if (f->daily_max_ppm == 1e7) f->daily_max_ppm = 0;
+  if (f->daily_min_range == 1440) f->daily_min_range = 0;
+  if (f->num_days > 0) ave_hits /= f->num_days;
+  f->daily_pages = ave_hits;
+  f->daily_ave_hit = ave_hits;
+}
+
+void UniqSketch::Add (uint32_t key)
+{
+  // register from the low bits of the hash, rank from the leading zeros of the rest
+  uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 31;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 29;
+  int i = int(h % UNIQ_REGS);
+  int rank = 1;
+  for (uint64_t x = h >> 6; rank < 15 && (x & 0x0200000000000000ULL) == 0; x <<= 1) rank++;
+  if (rank > getReg(i)) {
+    int sh = (i & 15) * 4;
+    reg[i >> 4] = (reg[i >> 4] & ~(15ULL << sh)) | (uint64_t(rank) << sh);
+  }
+}
+
+void UniqSketch::Merge (const UniqSketch& src)
+{
+  for (int w = 0; w < 4; w++) {
+    uint64_t a = reg[w], b = src.reg[w], out = 0;
+    for (int sh = 0; sh < 64; sh += 4) out |= std::max ( (a >> sh) & 15, (b >> sh) & 15 ) << sh;
+    reg[w] = out;
+  }
+}
+
+float UniqSketch::Estimate () const
+{
+  // hyperloglog estimate, linear counting while registers are empty
+  float sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < UNIQ_REGS; i++) {
+    int rank = getReg(i);
+    sum += ldexpf ( 1.0f, -rank );
+    if (rank == 0) zeros++;
+  }
+  float est = 0.709f * UNIQ_REGS * UNIQ_REGS / sum;
+  if (est <= 2.5f * UNIQ_REGS && zeros > 0) est = UNIQ_REGS * logf ( float(UNIQ_REGS) / zeros );
+  return est;
+}
+
+void TopK::Init (int counters)
+{
+  m_max = std::max ( 1, counters );
+  m_heap.clear ();
+  m_pos.clear ();
+  m_pos.reserve ( m_max * 2 );
+}
+
+void TopK::Add (uint64_t key)
+{
+  std::unordered_map<uint64_t, int>::iterator it = m_pos.find ( key );
+  if (it != m_pos.end()) {
+    m_heap[ it->second ].cnt++;
+    SiftDown ( it->second );
+    return;
+  }
+  if ((int) m_heap.size() < m_max) {
+    TopCount c = { key, 1, 0 };
+    m_heap.push_back ( c );
+    m_pos[key] = (int) m_heap.size() - 1;
+    SiftUp ( (int) m_heap.size() - 1 );
+    return;
+  }
+  // take over the smallest counter
+  TopCount& c = m_heap[0];
+  m_pos.erase ( c.key );
+  c.key = key;
+  c.err = c.cnt;
+  c.cnt++;
+  m_pos[key] = 0;
+  SiftDown ( 0 );
+}
+
+void TopK::Swap (int a, int b)
+{
+  std::swap ( m_heap[a], m_heap[b] );
+  m_pos[ m_heap[a].key ] = a;
+  m_pos[ m_heap[b].key ] = b;
+}
+
+void TopK::SiftUp (int i)
+{
+  while (i > 0 && m_heap[i].cnt < m_heap[(i-1)/2].cnt) {
+    Swap ( i, (i-1)/2 );
+    i = (i-1)/2;
+  }
+}
+
+void TopK::SiftDown (int i)
+{
+  int num = (int) m_heap.size();
+  for (;;) {
+    int c = 2*i + 1;
+    if (c >= num) return;
+    if (c + 1 < num && m_heap[c+1].cnt < m_heap[c].cnt) c++;
+    if (m_heap[i].cnt <= m_heap[c].cnt) return;
+    Swap ( i, c );
+    i = c;
+  }
+}
+
+void TopK::getTop (int num, std::vector<TopCount>& out) const
+{
+  out = m_heap;
+  std::sort ( out.begin(), out.end(), [](const TopCount& a, const TopCount& b) { return (a.cnt != b.cnt) ? (a.cnt > b.cnt) : (a.key < b.key); } );
+  if ((int) out.size() > num) out.resize ( num );
+}
+
+void RateState::Add (uint32_t t, uint32_t page, bool rob)
+{
+  // decay the counts to this hit, then count it
+  float dt = (hits > 0 && t > last) ? float(t - last) : 0;
+  for (int w = 0; w < RATE_MAX; w++) {
+    if (dt > 0) cnt[w] *= expf ( -dt / rate_secs[w] );
+    cnt[w] += 1;
+    if (cnt[w] > peak[w]) peak[w] = cnt[w];
+  }
+  if (hits == 0 || t > last) last = t;
+  if (rob) robots++;
+  hits++;
+
+  pages.Add ( page );
+}
+
+float RateState::getUniq () const
+{
+  return std::min ( pages.Estimate(), float(hits) );
+}
+
+void LogRip::ComputeRates ( IPInfo* f, const std::vector<size_t>& order )
+{
+  // rolling rates, with the policy checked at every hit
+  // - a burst is flagged when it happens, not averaged into its day:
+  //   hits over a rolling day > max_daily_hits, robots.txt > max_robot, pages/min over 10 mins > max_daily_ppm
+  // - hits of m_Log before log_end are already folded in, so follow mode adds only the new hits.
+  //   a new hit is not always later than the folded ones (log lines a few secs out of order),
+  //   so they are picked by log position, not by their place in order. a late hit counts at the last time
+  RateState& r = m_IPList[f->lev].getRate ( f );
+  int max_hits = getI(CONF_MAX_DAILY_HITS);
+  int max_robot = getI(CONF_MAX_ROBOT);
+  float max_ppm = getF(CONF_MAX_DAILY_PPM);
+  int s;
+
+  for (size_t i = 0; i < order.size(); i++) {
+    if (order[i] < r.log_end) continue;
+    const LogInfo& h = m_Log[ order[i] ];
+    r.Add ( h.time, h.page, m_Pages.isRobots(h.page) );
+
+    s = 0;
+    if (r.robots > max_robot)           s = 5;
+    if (r.cnt[RATE_DAY] > max_hits)     s = 4;
+    if (r.getPPM(RATE_10M) > max_ppm)   s = 1;
+    if (s > 0 && (r.score == 0 || s < r.score)) r.score = s;
+    if (s > 0 && r.flag_time == 0) r.flag_time = h.time;
+  }
+  r.log_end = m_Log.size();
+  assert ( r.hits == order.size() );      // every hit folded in exactly once
+}
+
+void LogRip::ComputeTop (size_t start, size_t end)
+{
+  // count hits m_Log[start..end) by page and by IP, in fixed memory. start 0 counts from scratch
+  if (start == 0) {
+    int counters = std::max ( 1, getI(CONF_SKETCH_TOP) ) * 8;
+    m_TopPages.Init ( counters );
+    m_TopIPs.Init ( counters );
+  }
+  for (size_t n = start; n < end; n++) {
+    m_TopPages.Add ( m_Log[n].page );
+    m_TopIPs.Add ( m_Log[n].ip );
+  }
+}
+
+void LogRip::ComputeScore (IPInfo* f)
+{	
+  // blocking score
+  // example:	
+  // +1  rate throttle (daily hit > 20, ppm > 20)
+  // +2  consecusive metric (days > 5, hr/day > 6)
+  // +3  daily range (hr/day > 6)
+  // +4  day thottle (hits/day > 100)
+  // +5  subnet (# ips > 40)
+  // +10 subnet C (/w any other blocking)
+  // +20 subnet B (/w any other blocking)
+
+  int score = 0;
+
+  if (f->lev == SUB_B && f->ip_cnt < getI(CONF_MIN_IPB)) return;
+  if (f->lev == SUB_C && f->ip_cnt < getI(CONF_MIN_IPC)) return;
+  
+  if (f->lev == SUB_C && f->ip_cnt > getI(CONF_MAX_IPC)) score = 6;
+  if (f->num_robots > getI(CONF_MAX_ROBOT) )        score = 5;
+  if (f->daily_max_hit > getI(CONF_MAX_DAILY_HITS)) score = 4;
+  if (f->daily_max_range > getI(CONF_MAX_DAILY_RANGE)) score = 3;
+  if (f->max_consecutive >= getI(CONF_MAX_CONSEC_DAYS) && f->daily_max_range > getI(CONF_MAX_CONSEC_RANGE) ) score = 2;
+  if (f->daily_ave_hit > getI(CONF_MAX_DAILY_AVE) && f->daily_max_ppm > getF(CONF_MAX_DAILY_PPM)) score = 1;
+
+  // bursts that the daily metrics average out
+  if (score == 0 && getB(CONF_ROLLING)) score = m_IPList[f->lev].getRate ( f ).score;
+
+  f->score = score;
+  
+  f->block = 0;  // blocking action is not computed here
+}
+
+std::string scoreReason (int score)
+{
+  switch (score) {
+  case 6: return "#mach";
+  case 5: return "robots";
+  case 4: return "daily hits";
+  case 3: return "daily range";
+  case 2: return "consecutive";
+  case 1: return "too fast";
+  };
+  return "";
+}
+
+void LogRip::PrintReason (IPInfo* f)
+{
+  if (f->score > 0 ) {    
+    std::string whystr = scoreReason ( f->score );
+    if (f->lev==SUB_B) whystr += " B-subnet";
+    if (f->lev==SUB_C) whystr += " C-subnet";
+    printf ( "  IP: %s, Reason: %s\n", ipToStr(f->ip, getBits(f->ip, f->lev)).c_str(), whystr.c_str() );      // print cause of blocking
+  }
+}
+
+
+void LogRip::ProcessIPs( int lev )
+{
+  // Process IPs
+  // - each IP reads only its own hits and writes only its own record,
+  //   so IPs are processed on worker threads, each with its own scratch
+  IPTable& list = m_IPList[ lev ];
+
+  std::vector<IPInfo*> ips ( list.size() );
+  for (size_t n = 0; n < list.size(); n++) ips[n] = &list[n];
+
+  ProcessList ( ips );
+}
+
+void LogRip::ProcessList ( std::vector<IPInfo*>& ips )
+{
+  int num = (int) ips.size();
+  int num_threads = std::min ( getThreads(), std::max ( 1, num / 1024 ) );
+  std::atomic<int> next (0);
+
+  auto worker = [&]() {
+    IPScratch scr;
+    if (!getB(CONF_SKETCH)) scr.page_mark.assign ( m_Pages.Count(), 0 );     // exact unique pages
+    scr.mark = 0;
+    int i;
+    while ( (i = next.fetch_add ( 256 )) < num ) {       // batches of 256 IPs
+      int end = std::min ( i + 256, num );
+      for (; i < end; i++) ProcessIP ( ips[i], scr );
+    }
+  };
+  if (num_threads == 1) {
+    worker ();
+  } else {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) workers.push_back ( std::thread ( worker ) );
+    for (int t = 0; t < num_threads; t++) workers[t].join();
+  }
+
+  // print causes of blocking, in IP order
+  if ( getB(CONF_REASONS) ) {
+    for (int i = 0; i < num; i++) PrintReason ( ips[i] );
+  }
+}
+
+void LogRip::ProcessIP ( IPInfo* f, IPScratch& scr )
+{
+  // order hits by time
+  GatherHits ( f, scr );
+
+  // count unique pages
+  if ( getB(CONF_SKETCH) ) {
+    // sketch of the IP's pages, subnets are the union of their IPs (InsertIP, RefreshSubnet)
+    UniqSketch& uniq = m_IPList[f->lev].getUniq ( f );
+    if (f->lev == SUB_D) {
+      uniq.Clear ();
+      for (size_t j = 0; j < scr.order.size(); j++) uniq.Add ( m_Log[ scr.order[j] ].page );
+    }
+    f->uniq_cnt = std::min ( int(uniq.Estimate() + 0.5f), f->page_cnt );
+  } else {
+    scr.mark++;
+    f->uniq_cnt = 0;
+    for (size_t j = 0; j < scr.order.size(); j++) {
+      uint32_t page = m_Log[ scr.order[j] ].page;
+      if (scr.page_mark[ page ] != scr.mark) {
+        scr.page_mark[ page ] = scr.mark;
+        f->uniq_cnt++;
+      }
+    }
+  }
+
+  // get total elapsed 
+  f->elapsed = elapsedDays(f->end_time, f->start_time);
+  
+  // compute daily metrics
+  double t = m_Prof.StepStart();
+  ComputeDailyMetrics ( f, scr.order );
+  m_Prof.Step ( STEP_DAYS, t, scr.order.size() );
+
+  // rolling rates
+  if ( getB(CONF_ROLLING) ) ComputeRates ( f, scr.order );
+
+  // print day info (debugging)
+  /* dbgprintf("START %s: %s\n", ipToStr(f->ip).c_str(), writeTime(f->start_time).c_str());
+  for (int j = 0; j < scr.order.size(); j++) {
+    dbgprintf("   %s, %s\n", writeTime(m_Log[scr.order[j]].time).c_str(), m_Pages.getStr(m_Log[scr.order[j]].page));
+  }
+  dbgprintf ( "  METRICS %s\n", ipToStr(f->ip, getBits(f->ip, f->lev)).c_str());
+  dbgprintf ( "  consecutive: %d\n", f->max_consecutive);
+  dbgprintf ( "  robots.txt:  %d\n", f->num_robots);
+  dbgprintf ( "  daily hits:  min %f, max %f (hits), AVE: %f (hits)\n", f->daily_min_hit, f->daily_max_hit, f->daily_ave_hit);
+  dbgprintf ( "  daily ppm:   min %f, max %f (page/min)\n", f->daily_min_ppm, f->daily_max_ppm);
+  dbgprintf ( "  daily range: min %f, max %f (mins)\n", f->daily_min_range, f->daily_max_range);   */
+
+  // compute the page time deltas (frequency)
+  scr.diffs.clear ();
+  for (int i = 1; i < scr.order.size(); i++) {
+    scr.diffs.push_back ( elapsedSec(m_Log[scr.order[i]].time, m_Log[scr.order[i-1]].time) );
+  }
+
+  // get median (ignore outliers and time gaps)
+  f->visit_freq = (scr.diffs.size()==0) ? 0 : scr.diffs[ scr.diffs.size()/2 ];     // median
+  f->visit_time = elapsedSec(f->end_time, f->start_time) / f->page_cnt; // est. visit time
+  f->elapsed = elapsedDays(f->end_time, f->start_time);
+
+  // Compute blocklist score
+  ComputeScore ( f );
+}
+
+void LogRip::GatherHits ( IPInfo* f, IPScratch& scr )
+{
+  // hits of an IP or subnet in time order
+  // - base hits are a range of the sorted m_Log, merged from their per-IP runs
+  // - hits added in follow mode are in the delta list of the IP or subnet, merged in by time
+  size_t n;
+  scr.order.clear ();
+  assert ( f->lev >= SUB_A && f->lev < SUB_MAX );     // not ASNs, they have no hits of their own
+  if (f->lev >= SUB_MAX) return;
+  scr.hits.Start ( m_Log, f->first, f->base_cnt );
+
+  std::unordered_map< uint64_t, std::vector<size_t> >::const_iterator it = m_Delta[f->lev].find ( f->ip );
+  if (it == m_Delta[f->lev].end()) {
+    while ( scr.hits.Next ( n ) ) scr.order.push_back ( n );
+    return;
+  }
+  const std::vector<size_t>& delta = it->second;
+  size_t j = 0;
+  bool more = scr.hits.Next ( n );
+  while (more || j < delta.size()) {
+    if (more && (j == delta.size() || m_Log[n].time <= m_Log[ delta[j] ].time)) {
+      scr.order.push_back ( n );
+      more = scr.hits.Next ( n );
+    } else {
+      scr.order.push_back ( delta[j++] );
+    }
+  }
+}
+
+IPInfo* LogRip::InsertIP ( IPInfo i, IPTable& dest, int dest_lev )
+{
+  // find or insert
+  bool created;
+  IPInfo* f = &dest.Insert ( i.ip, created );
+
+  if (created) {
+    f->lev = dest_lev;
+    f->geo = i.geo;
+    f->score = 0;
+    f->block = 0;
+    f->start_time = i.start_time;
+    f->end_time = i.end_time;
+    f->daily_min_hit = i.daily_min_hit;
+    f->daily_max_hit = i.daily_max_hit;
+    f->daily_min_ppm = i.daily_min_ppm;
+    f->daily_max_ppm = i.daily_max_ppm;
+    f->daily_min_range = i.daily_min_range;
+    f->daily_max_range = i.daily_max_range;
+    f->max_consecutive = i.max_consecutive;
+    f->num_robots = i.num_robots;
+    f->visit_freq = 0;
+    f->visit_time = 0;
+    f->ip_cnt = 0;
+    f->page_cnt = 0;
+    f->uniq_cnt = 0;
+    f->base_cnt = 0;
+  }
+  
+  // update	
+  f->ip = i.ip;
+
+  // children arrive in ip order, the subnet range starts at its first child with hits
+  if (f->base_cnt == 0) f->first = i.first;
+  f->base_cnt += i.base_cnt;
+  f->page_cnt += i.page_cnt;
+  f->uniq_cnt += i.uniq_cnt;
+  f->ip_cnt += i.ip_cnt;
+  float cnt = f->ip_cnt;
+  f->visit_freq = (f->visit_freq * float(cnt-1) + i.visit_freq)/cnt;
+  f->visit_time = (f->visit_time * float(cnt-1) + i.visit_time)/cnt;
+  f->daily_pages = (f->daily_pages * float(cnt-1) + i.daily_pages)/cnt;
+  if (i.start_time < f->start_time)	f->start_time = i.start_time;
+  if (i.end_time > f->end_time)		f->end_time = i.end_time;
+  if (i.daily_min_hit < f->daily_min_hit)		f->daily_min_hit = i.daily_min_hit;
+  if (i.daily_max_hit > f->daily_max_hit)		f->daily_max_hit = i.daily_max_hit;
+  if (i.daily_min_ppm < f->daily_min_ppm)		f->daily_min_ppm = i.daily_min_ppm;
+  if (i.daily_max_ppm > f->daily_max_ppm)		f->daily_max_ppm = i.daily_max_ppm;
+  if (i.daily_min_range < f->daily_min_range) f->daily_min_range = i.daily_min_range;
+  if (i.daily_max_range > f->daily_max_range) f->daily_max_range = i.daily_max_range;
+  f->elapsed = elapsedDays(f->end_time, f->start_time);	
+  return f;
+}
+
+void LogRip::ConstructSubnet ( int src_lev, int dest_lev )
+{
+  IPInfo i;	
+
+  IPTable& src = m_IPList[src_lev];	
+  IPTable& dest = m_IPList[dest_lev];
+  
+  // insert all IPs into parent subnet	
+  for (size_t n = 0; n < src.size(); n++) {
+    IPInfo& f = src[n];
+    i = f;
+
+    // subnet ip		
+    i.ip = getMaskedIP ( f.ip, dest_lev );		
+
+    // insert into parent, a subnet sketch is the union of its children
+    IPInfo* p = InsertIP (i, dest, dest_lev );
+    if ( getB(CONF_SKETCH) ) {
+      UniqSketch& uniq = dest.getUniq ( p );
+      uniq.Merge ( src.getUniq ( &f ) );
+      p->uniq_cnt = std::min ( int(uniq.Estimate() + 0.5f), p->page_cnt );
+    }
+  }
+}
+
+void LogRip::ComputeGeo ()
+{
+  // annotate every level from the geo database
+  for (int lev = SUB_A; lev < SUB_MAX; lev++)
+    m_Geo.Annotate ( m_IPList[lev], lev );
+
+  // group IPs by ASN, crawlers often rotate addresses within one ASN
+  // - for reporting, ASNs are not scored or blocked
+  IPTable& src = m_IPList[SUB_D];
+  std::vector< std::pair<uint32_t, size_t> > by_asn;
+  for (size_t n = 0; n < src.size(); n++) {
+    if (src[n].geo != 0) by_asn.push_back ( std::make_pair ( m_Geo.getASN( src[n].geo ), n ) );
+  }
+  std::sort ( by_asn.begin(), by_asn.end() );
+
+  // the IPs of an ASN are scattered over the D level, so unique pages are
+  // the union of their hits, marked once per ASN
+  IPScratch scr;
+  scr.page_mark.assign ( m_Pages.Count(), 0 );
+  scr.mark = 0;
+  IPInfo* f;
+  m_ASNList.Clear();
+  for (size_t k = 0; k < by_asn.size(); k++) {
+    IPInfo& i = src[ by_asn[k].second ];
+    if (k == 0 || by_asn[k].first != by_asn[k-1].first) scr.mark++;
+    f = InsertASN ( i, by_asn[k].first );
+    GatherHits ( &i, scr );
+    for (size_t j = 0; j < scr.order.size(); j++) {
+      uint32_t page = m_Log[ scr.order[j] ].page;
+      if (scr.page_mark[ page ] != scr.mark) {
+        scr.page_mark[ page ] = scr.mark;
+        f->uniq_cnt++;
+      }
+    }
+  }
+}
+
+IPInfo* LogRip::InsertASN ( const IPInfo& i, uint32_t asn )
+{
+  // add an IP to its ASN
+  // - the IPs are not a range of m_Log, so the ASN has no first/base_cnt
+  // - robots are summed, max_consecutive is the longest run of any one IP
+  // - uniq_cnt is counted by ComputeGeo
+  bool created;
+  IPInfo* f = &m_ASNList.Insert ( asn, created );
+
+  if (created) {
+    f->lev = SUB_ASN;
+    f->geo = i.geo;
+    f->start_time = i.start_time;
+    f->end_time = i.end_time;
+    f->daily_min_hit = i.daily_min_hit;
+    f->daily_max_hit = i.daily_max_hit;
+    f->daily_min_ppm = i.daily_min_ppm;
+    f->daily_max_ppm = i.daily_max_ppm;
+    f->daily_min_range = i.daily_min_range;
+    f->daily_max_range = i.daily_max_range;
+    f->first = 0;
+    f->base_cnt = 0;
+  }
+
+  f->page_cnt += i.page_cnt;
+  f->num_robots += i.num_robots;
+  if (i.max_consecutive > f->max_consecutive) f->max_consecutive = i.max_consecutive;
+  f->ip_cnt += i.ip_cnt;
+  float cnt = f->ip_cnt;
+  f->visit_freq = (f->visit_freq * float(cnt-1) + i.visit_freq)/cnt;
+  f->visit_time = (f->visit_time * float(cnt-1) + i.visit_time)/cnt;
+  f->daily_pages = (f->daily_pages * float(cnt-1) + i.daily_pages)/cnt;
+  if (i.start_time < f->start_time)	f->start_time = i.start_time;
+  if (i.end_time > f->end_time)		f->end_time = i.end_time;
+  if (i.daily_min_hit < f->daily_min_hit)		f->daily_min_hit = i.daily_min_hit;
+  if (i.daily_max_hit > f->daily_max_hit)		f->daily_max_hit = i.daily_max_hit;
+  if (i.daily_min_ppm < f->daily_min_ppm)		f->daily_min_ppm = i.daily_min_ppm;
+  if (i.daily_max_ppm > f->daily_max_ppm)		f->daily_max_ppm = i.daily_max_ppm;
+  if (i.daily_min_range < f->daily_min_range) f->daily_min_range = i.daily_min_range;
+  if (i.daily_max_range > f->daily_max_range) f->daily_max_range = i.daily_max_range;
+  f->elapsed = elapsedDays(f->end_time, f->start_time);
+  return f;
+}
+
+
+void LogRip::CreateImg(int xr, int yr)
+{
+  for (int i=0; i < I_NUM; i++)
+    m_img[i].Resize( xr, yr, ImageOp::RGB8 );	
+}
+
+void LogRip::OutputHits ( std::string filename )
+{	
+  CSVWriter out;
+  if (!out.Open ( filename )) {
+    dbgprintf("ERROR: Unable to open outhits.csv for writing.\n");
+    exit(-1);
+  }
+  // hits in time order, from the store
+  uint32_t first_tm = m_Store.getFirst();
+  out.Str ( "firstdate, " + writeTime(first_tm) + "\n" );
+    
+  for (size_t n = 0; n < m_Store.size(); n++) {
+  
+    float tm = float(m_Store.getTime(n) - first_tm) / SEC_PER_DAY;
+    Vec4F ipvec = ipToVec(m_Store.getIP(n));
+    float ip = ipvec.x*256 + ipvec.y + (ipvec.z/256.0f);
+
+    out.Float ( tm ); out.Str ( ", ", 2 ); out.Float ( ip ); out.Char ( '\n' );
+  }
+
+  out.Close ();
+}
+
+void LogRip::OutputStats(std::string filename, std::string imgname)
+{
+  FILE* outcsv;
+  LogInfo* i;
+  Vec3I actions;
+
+  outcsv = fopen(filename.c_str(), "wt");
+  if (outcsv == 0x0) {
     dbgprintf("ERROR: Unable to open %s for writing.\n", filename.c_str());
     exit(-1);
   }
@@ -1154,18 +3674,14 @@ void LogRip::OutputStats(std::string filename, std::string imgname)
     m_DayList[d].stats.Set(0,0,0);
   }
   
-  // insert every hit into day histogram
-  // - do not assume log is in time order
-  for (int n = 0; n < m_Log.size(); n++) {
-
-    LogInfo& i = m_Log[n];    
-
-    // determine actions taken
-    actions.Set(1, i.block != 0, i.block == 0);
-
-    // find and set day accordingly
-    int day = i.date.GetElapsedDays (m_date_min);
-    m_DayList[day].stats += actions;
+  // day histogram, each day is a range of the store. only the blocking actions are read
+  size_t lo, hi;
+  for (int d = 0; d < m_total_days; d++) {
+    uint32_t t0 = m_time_min + d * SEC_PER_DAY;
+    m_Store.getRange ( t0, t0 + SEC_PER_DAY, lo, hi );
+    int blocked = 0;
+    for (size_t n = lo; n < hi; n++) blocked += (m_Store.getBlock(n) != 0);
+    m_DayList[d].stats.Set ( int(hi - lo), blocked, int(hi - lo) - blocked );
   }
 
 
@@ -1217,8 +3733,7 @@ void LogRip::OutputStats(std::string filename, std::string imgname)
 
 void LogRip::ComputeBlocklist ()
 {
-  IPMap_t* list;
-  std::map<uint32_t, IPInfo>::iterator it;
+  IPTable* list;
   IPInfo* f;
   IPInfo *fb, *fc, *fd;
 
@@ -1227,84 +3742,553 @@ void LogRip::ComputeBlocklist ()
 
   // Class B Blocking
   list =  &m_IPList[ SUB_B ];
-  for (it = list->begin(); it != list->end(); it++) {
-    fb = &it->second;	
+  for (size_t n = 0; n < list->size(); n++) {
+    fb = &(*list)[n];	
     if (fb->score >= score_min && fb->score <= score_max ) {
         fb->block = 'B';        // block by B subnet, highest level (we don't block at A subnet level)
+    } else {
+        fb->block = 0;
     }
   }
 
   // Class C Blocking
+  // - both levels are sorted by ip, so the parent is found by walking the B level alongside
+  IPTable& listb = m_IPList[ SUB_B ];
+  size_t j = 0;
   list =  &m_IPList[ SUB_C ];
-  for (it = list->begin(); it != list->end(); it++) {
-    fc = &it->second;
-    fb = FindIP(fc->ip, SUB_B);
+  for (size_t n = 0; n < list->size(); n++) {
+    fc = &(*list)[n];
+    uint64_t pip = getMaskedIP(fc->ip, SUB_B);
+    while (j < listb.size() && listb[j].ip < pip) j++;
+    fb = (j < listb.size() && listb[j].ip == pip) ? &listb[j] : 0x0;
     if (fb != 0x0 && fb->block !=0 ) {
       fc->block = fb->block;  // block by parent
     } else if (fc->score >= score_min && fc->score <= score_max ) {
       fc->block = 'C';        // block by C-net
+    } else {
+      fc->block = 0;
     }
   }
 
   // IP-Level Blocking
+  IPTable& listc = m_IPList[ SUB_C ];
+  j = 0;
   list =  &m_IPList[ SUB_D ];
-  for (it = list->begin(); it != list->end(); it++) {
-    fd = &it->second;	
-    fc = FindIP(fd->ip, SUB_C);
+  for (size_t n = 0; n < list->size(); n++) {
+    fd = &(*list)[n];	
+    uint64_t pip = getMaskedIP(fd->ip, SUB_C);
+    while (j < listc.size() && listc[j].ip < pip) j++;
+    fc = (j < listc.size() && listc[j].ip == pip) ? &listc[j] : 0x0;
     if (fc != 0x0 && fc->block !=0 ) {
       fd->block = fc->block;    // block by parent
     } else if (fd->score >= score_min && fd->score <= score_max ) {
       fd->block = 'I';          // block IP
+    } else {
+      fd->block = 0;
     }
   }
 
   // Map IP blocklist back to log events 
-  for (int n = 0; n < m_Log.size(); n++) {
-    LogInfo& i = m_Log[n];
-    // find IP 
-    fd = FindIP(i.ip, SUB_D);
-    m_Log[n].block = fd->block;
+  // - each IP owns a contiguous range of the sorted base of m_Log
+  m_HitBlock.assign ( m_Log.size(), 0 );
+  for (size_t n = 0; n < list->size(); n++) {
+    fd = &(*list)[n];
+    if (fd->block != 0) memset ( &m_HitBlock[fd->first], fd->block, fd->base_cnt );
+  }
+  // - hits added after the base (follow mode)
+  for (size_t k = m_base_hits; k < m_Log.size(); k++) {
+    fd = FindIP(m_Log[k].ip, SUB_D);
+    m_HitBlock[k] = (fd != 0x0) ? fd->block : 0;
   }
 
    
 
 }
 
-void LogRip::OutputBlocklist (std::string filename)
+CIDRNet LogRip::BlockNet (IPInfo* f)
 {
-  FILE* fp;	
-  fp = fopen(filename.c_str(), "wt");
-  if (fp == 0x0) {
-    dbgprintf("ERROR: Unable to open %s for writing.\n", filename.c_str() );
-    exit(-1);
+  // CIDR of a blocked subnet
+  CIDRNet c;
+  c.bits = getBits(f->ip, f->lev);
+  c.net = f->ip;
+  if ( getB(CONF_TIGHT_PREFIX) ) {
+    // tightest prefix covering the IPs seen in the subnet
+    IPTable& ips = m_IPList[ SUB_D ];
+    size_t lo = ips.LowerBound ( f->ip );
+    size_t hi = ips.LowerBound ( f->ip | ~getMask(f->ip, f->lev) );
+    if (hi == ips.size() || !memberOf ( ips[hi].ip, f->ip, f->lev )) hi--;
+    if (lo <= hi && hi < ips.size()) {
+      c.bits = commonPrefix ( ips[lo].ip, ips[hi].ip );
+      int kbits = isIPv6(c.net) ? c.bits : c.bits + 32;
+      c.net = ips[lo].ip & (0xFFFFFFFFFFFFFFFFULL << (64 - kbits));
+    }
+  }
+  return c;
+}
+
+std::string LogRip::BlockPrefix (IPInfo* f)
+{
+  return cidrToStr ( BlockNet ( f ) ) + "\n";
+}
+
+void LogRip::CollectBlocklist (std::vector<CIDRNet>& nets)
+{
+  // blocked subnets and IPs, same entries as BuildBlocklist
+  nets.clear();
+  for (int lev = SUB_B; lev <= SUB_D; lev++) {
+    IPTable& list = m_IPList[ lev ];
+    char action = (lev == SUB_B) ? 'B' : (lev == SUB_C) ? 'C' : 'I';
+    for (size_t n = 0; n < list.size(); n++) {
+      if (list[n].block != action) continue;
+      if (lev == SUB_D) {
+        CIDRNet c = { list[n].ip, getBits(list[n].ip, SUB_D) };
+        nets.push_back ( c );
+      } else {
+        nets.push_back ( BlockNet ( &list[n] ) );
+      }
+    }
   }
+}
 
-  IPMap_t* list;
-  std::map<uint32_t, IPInfo>::iterator it;
+std::string LogRip::BuildBlocklist ()
+{
+  std::string out;
+  IPTable* list;
   IPInfo* f;
   
   // Class B Blocking
   list =  &m_IPList[ SUB_B ];
-  for (it = list->begin(); it != list->end(); it++) {
-    f = &it->second;	
-    if (f->block == 'B') fprintf (fp, "%s/16\n", ipToStr(f->ip, '0').c_str());
+  for (size_t n = 0; n < list->size(); n++) {
+    f = &(*list)[n];	
+    if (f->block == 'B') out += BlockPrefix ( f );
   }
 
   // Class C Blocking
   list =  &m_IPList[ SUB_C ];
-  for (it = list->begin(); it != list->end(); it++) {
-    f = &it->second;
-    if (f->block =='C') fprintf (fp, "%s/24\n", ipToStr(f->ip, '0').c_str() );
+  for (size_t n = 0; n < list->size(); n++) {
+    f = &(*list)[n];
+    if (f->block =='C') out += BlockPrefix ( f );
   }
 
   // IP-Level Blocking
   list =  &m_IPList[ SUB_D ];
-  for (it = list->begin(); it != list->end(); it++) {
-    f = &it->second;	
-    if (f->block =='I') fprintf (fp, "%s\n", ipToStr(f->ip, '0').c_str() );
+  for (size_t n = 0; n < list->size(); n++) {
+    f = &(*list)[n];	
+    if (f->block =='I') out += ipToStr(f->ip, getBits(f->ip, SUB_D)) + "\n";
+  }
+  return out;
+}
+
+void LogRip::OutputBlocklist (std::string filename)
+{
+  FILE* fp;	
+  fp = fopen(filename.c_str(), "wt");
+  if (fp == 0x0) {
+    dbgprintf("ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }
+  std::string list = BuildBlocklist ();
+  fwrite ( list.c_str(), 1, list.size(), fp );
+
+  fclose(fp);
+
+  OutputFirewall ();
+}
+
+static void writeElements (FILE* fp, const char* cmd, const char* set, std::vector<std::string>& elems)
+{
+  // nft element commands, in lines of at most 1000 elements
+  for (size_t n = 0; n < elems.size(); n += 1000) {
+    fprintf ( fp, "%s element inet %s %s { ", cmd, NFT_TABLE, set );
+    for (size_t k = n; k < elems.size() && k < n + 1000; k++)
+      fprintf ( fp, (k == n) ? "%s" : ", %s", elems[k].c_str() );
+    fprintf ( fp, " }\n" );
+  }
+}
+
+void LogRip::OutputFirewall ()
+{
+  // firewall updates for the blocklist, as an nft script (nft -f) and an ipset restore file (ipset restore -exist)
+  // - the blocklist is collapsed to the fewest CIDR blocks
+  // - block_state holds the list last applied. when present, only removed and added blocks are written,
+  //   otherwise the sets are reloaded in full. the nft script applies as one transaction either way.
+  // - the new list goes to block_state.pending, which becomes block_state once the script is applied (block_ips.sh).
+  //   an update that failed or was skipped is then still diffed against what the firewall holds
+  std::string nft_file = getStr( CONF_BLOCK_NFT );
+  std::string ipset_file = getStr( CONF_BLOCK_IPSET );
+  std::string state_file = getStr( CONF_BLOCK_STATE );
+  if (nft_file.empty() && ipset_file.empty()) return;
+
+  std::vector<CIDRNet> nets;
+  CollectBlocklist ( nets );
+  size_t num_prefixes = nets.size();
+  collapseCIDR ( nets );
+
+  // previous list
+  bool full = true;
+  std::vector<std::string> prev;
+  FILE* fp = state_file.empty() ? 0x0 : fopen ( state_file.c_str(), "rt" );
+  if (fp != 0x0) {
+    char buf[128];
+    while (fgets ( buf, 128, fp )) {
+      std::string line = buf;
+      while (!line.empty() && isspace((unsigned char) line.back())) line.pop_back();
+      if (!line.empty()) prev.push_back ( line );
+    }
+    fclose ( fp );
+    full = false;
+  }
+
+  // diff, per family. IPv6 blocks contain ':'
+  std::vector<std::string> cur, add[2], del[2];
+  std::unordered_map<std::string, char> in_prev, in_cur;
+  for (size_t n = 0; n < prev.size(); n++) in_prev[ prev[n] ] = 1;
+  for (size_t n = 0; n < nets.size(); n++) {
+    cur.push_back ( cidrToStr ( nets[n] ) );
+    in_cur[ cur.back() ] = 1;
+    if (full || in_prev.find ( cur.back() ) == in_prev.end()) add[ isIPv6(nets[n].net) ].push_back ( cur.back() );
+  }
+  for (size_t n = 0; n < prev.size() && !full; n++) {
+    if (in_cur.find ( prev[n] ) == in_cur.end()) del[ prev[n].find(':') != std::string::npos ].push_back ( prev[n] );
+  }
+  const char* sets[2] = { NFT_SET, NFT_SET6 };
+  const char* family[2] = { "inet", "inet6" };
+
+  if (!nft_file.empty()) {
+    fp = fopen ( nft_file.c_str(), "wt" );
+    if (fp == 0x0) {
+      dbgprintf("ERROR: Unable to open %s for writing.\n", nft_file.c_str() );
+      exit(-1);
+    }
+    fprintf ( fp, "#!/usr/sbin/nft -f\n" );
+    fprintf ( fp, "# logrip blocklist, %s\n", full ? "full reload" : "update" );
+    fprintf ( fp, "table inet %s {\n", NFT_TABLE );
+    fprintf ( fp, "  set %s { type ipv4_addr; flags interval; }\n", NFT_SET );
+    fprintf ( fp, "  set %s { type ipv6_addr; flags interval; }\n", NFT_SET6 );
+    fprintf ( fp, "}\n" );
+    for (int f = 0; f < 2; f++) {
+      if (full) fprintf ( fp, "flush set inet %s %s\n", NFT_TABLE, sets[f] );
+      writeElements ( fp, "delete", sets[f], del[f] );
+      writeElements ( fp, "add", sets[f], add[f] );
+    }
+    fclose ( fp );
+  }
+
+  if (!ipset_file.empty()) {
+    fp = fopen ( ipset_file.c_str(), "wt" );
+    if (fp == 0x0) {
+      dbgprintf("ERROR: Unable to open %s for writing.\n", ipset_file.c_str() );
+      exit(-1);
+    }
+    for (int f = 0; f < 2; f++) {
+      fprintf ( fp, "create %s hash:net family %s maxelem %d\n", sets[f], family[f], IPSET_MAXELEM );
+      if (full) {
+        // fill a new set and swap it in
+        fprintf ( fp, "create %s_new hash:net family %s maxelem %d\n", sets[f], family[f], IPSET_MAXELEM );
+        fprintf ( fp, "flush %s_new\n", sets[f] );
+        for (size_t n = 0; n < add[f].size(); n++) fprintf ( fp, "add %s_new %s\n", sets[f], add[f][n].c_str() );
+        fprintf ( fp, "swap %s_new %s\n", sets[f], sets[f] );
+        fprintf ( fp, "destroy %s_new\n", sets[f] );
+      } else {
+        for (size_t n = 0; n < del[f].size(); n++) fprintf ( fp, "del %s %s\n", sets[f], del[f][n].c_str() );
+        for (size_t n = 0; n < add[f].size(); n++) fprintf ( fp, "add %s %s\n", sets[f], add[f][n].c_str() );
+      }
+    }
+    fclose ( fp );
+  }
+
+  if (!state_file.empty()) {
+    std::string pending_file = state_file + ".pending";
+    fp = fopen ( pending_file.c_str(), "wt" );
+    if (fp == 0x0) {
+      dbgprintf("ERROR: Unable to open %s for writing.\n", pending_file.c_str() );
+      exit(-1);
+    }
+    for (size_t n = 0; n < cur.size(); n++) fprintf ( fp, "%s\n", cur[n].c_str() );
+    fclose ( fp );
+  }
+
+  dbgprintf ( "  Firewall: %d prefixes as %d blocks, %s +%d -%d.\n", int(num_prefixes), int(cur.size()), full ? "full," : "update,",
+              int(add[0].size() + add[1].size()), int(del[0].size() + del[1].size()) );
+}
+
+static inline int visClass (char block)
+{
+  return (block == 'B') ? 1 : (block == 'C') ? 2 : (block == 'I') ? 3 : 0;
+}
+
+static inline float visIP (uint64_t ip)
+{
+  // y-axis position of an ip, in B-subnets (/16) of the A-subnet range
+  Vec4F ipvec = ipToVec(ip);
+  return ipvec.x * 256 + ipvec.y + (ipvec.z / 256.0f);
+}
+
+void toneMap (const DensityGrid& g, uint32_t maxcnt, ImageX* orig, ImageX* blocked, ImageX* filtered)
+{
+  // log density, so both single hits and dense crawls stay visible
+  // - orig and filtered are black by density, blocked mixes the class colors by their counts
+  // - maxcnt sets the top of the scale, 0 = the densest pixel
+  static const float clr[VIS_CLASSES][3] = { {128,128,128}, {0,0,255}, {255,0,255}, {255,0,0} };
+  const uint32_t* c;
+  if (maxcnt == 0) {
+    for (size_t k = 0; k < g.cnt.size(); k += VIS_CLASSES) {
+      c = &g.cnt[k];
+      maxcnt = std::max ( maxcnt, c[0] + c[1] + c[2] + c[3] );
+    }
+  }
+  float scale = 0.7f / logf ( 2.0f + maxcnt );
+
+  for (int y = 0; y < g.yres; y++) {
+    for (int x = 0; x < g.xres; x++) {
+      c = g.getCell ( x, y );
+      uint32_t all = c[0] + c[1] + c[2] + c[3];
+      if (all == 0) continue;
+      float v = std::min ( 1.0f, 0.3f + logf ( 1.0f + all ) * scale );
+      if (orig != 0x0) orig->SetPixel ( x, y, Vec4F( 255*(1-v), 255*(1-v), 255*(1-v), 255 ) );
+      if (blocked != 0x0) {
+        float mix[3] = { 0, 0, 0 };
+        for (int k = 0; k < VIS_CLASSES; k++)
+          for (int ch = 0; ch < 3; ch++) mix[ch] += clr[k][ch] * c[k] / all;
+        blocked->SetPixel ( x, y, Vec4F( 255 + (mix[0]-255)*v, 255 + (mix[1]-255)*v, 255 + (mix[2]-255)*v, 255 ) );
+      }
+      if (filtered != 0x0 && c[0] > 0) {
+        float vf = std::min ( 1.0f, 0.3f + logf ( 1.0f + c[0] ) * scale );
+        filtered->SetPixel ( x, y, Vec4F( 255*(1-vf), 255*(1-vf), 255*(1-vf), 255 ) );
+      }
+    }
+  }
+}
+
+template <class F> void DensityTile::forCells (F fn) const
+{
+  if (dense) {
+    for (size_t p = 0; p < size_t(VIS_TILE) * VIS_TILE; p++) {
+      const uint32_t* c = &cnt[ p * VIS_CLASSES ];
+      if ((c[0] | c[1] | c[2] | c[3]) != 0) fn ( int(p / VIS_TILE), int(p % VIS_TILE), c );
+    }
+  } else {
+    for (size_t n = 0; n < pos.size(); n++) fn ( pos[n] / VIS_TILE, pos[n] % VIS_TILE, &cnt[ n * VIS_CLASSES ] );
+  }
+}
+
+void DensityTile::Append (uint16_t p, const uint32_t* c)
+{
+  if (dense) {
+    for (int k = 0; k < VIS_CLASSES; k++) cnt[ size_t(p) * VIS_CLASSES + k ] += c[k];
+    return;
+  }
+  pos.push_back ( p );
+  cnt.insert ( cnt.end(), c, c + VIS_CLASSES );
+  if (pos.size() * VIS_CELL_BYTES >= VIS_DENSE_BYTES) MakeDense ();
+}
+
+void DensityTile::MakeDense ()
+{
+  std::vector<uint32_t> all ( size_t(VIS_TILE) * VIS_TILE * VIS_CLASSES, 0 );
+  for (size_t n = 0; n < pos.size(); n++) {
+    for (int k = 0; k < VIS_CLASSES; k++) all[ size_t(pos[n]) * VIS_CLASSES + k ] += cnt[ n * VIS_CLASSES + k ];
+  }
+  std::vector<uint16_t>().swap ( pos );
+  cnt.swap ( all );
+  dense = true;
+}
+
+void DensityTile::FromGrid (const DensityGrid& g)
+{
+  // the cells of a VIS_TILE grid, in the smaller form
+  size_t used = 0;
+  for (size_t k = 0; k < g.cnt.size(); k += VIS_CLASSES) used += (g.cnt[k] | g.cnt[k+1] | g.cnt[k+2] | g.cnt[k+3]) != 0;
+  pos.clear ();
+  cnt.clear ();
+  dense = false;
+  if (used * VIS_CELL_BYTES >= VIS_DENSE_BYTES) {
+    dense = true;
+    cnt.resize ( size_t(VIS_TILE) * VIS_TILE * VIS_CLASSES );
+  } else {
+    pos.reserve ( used );
+    cnt.reserve ( used * VIS_CLASSES );
+  }
+  for (int x = 0; x < VIS_TILE; x++) {
+    for (int y = 0; y < VIS_TILE; y++) {
+      const uint32_t* c = g.getCell ( x, y );
+      if (dense) memcpy ( &cnt[ (size_t(x) * VIS_TILE + y) * VIS_CLASSES ], c, VIS_CLASSES * sizeof(uint32_t) );
+      else if ((c[0] | c[1] | c[2] | c[3]) != 0) Append ( uint16_t(x * VIS_TILE + y), c );
+    }
+  }
+}
+
+void DensityTile::ToGrid (DensityGrid& g) const
+{
+  g.Resize ( VIS_TILE, VIS_TILE );
+  forCells ( [&g](int x, int y, const uint32_t* c) { memcpy ( g.getCell ( x, y ), c, VIS_CLASSES * sizeof(uint32_t) ); } );
+}
+
+void DensityPyramid::Build (const HitStore& store, uint32_t first_tm, int days, int levels)
+{
+  // as many levels as asked for (up to VIS_LEVELS) that fit in VIS_TILE_MEM
+  m_levels = std::max ( 1, std::min ( levels, VIS_LEVELS ) );
+  m_days = std::max ( 1, days );
+  while (!BuildLevels ( store, first_tm ) && m_levels > 1) m_levels--;
+}
+
+bool DensityPyramid::BuildLevels (const HitStore& store, uint32_t first_tm)
+{
+  // count every hit into the finest level, then sum 2x2 cells into each coarser level
+  // - the store is in time order, so the finest level fills one column of cells at a time.
+  //   a column is counted over all rows, then its cells go to their tiles in position order
+  // - false if the tiles outgrow VIS_TILE_MEM
+  m_tiles.assign ( m_levels, std::unordered_map<uint64_t, DensityTile>() );
+  m_bytes = 0;
+
+  int fine = m_levels - 1;
+  int res = VIS_TILE << fine;
+  std::unordered_map<uint64_t, DensityTile>& tiles = m_tiles[fine];
+  std::vector<uint32_t> col ( size_t(res) * VIS_CLASSES, 0 );
+  std::vector<int> rows;
+  int col_x = -1;
+
+  auto flush = [&]() -> bool {
+    std::sort ( rows.begin(), rows.end() );
+    for (size_t r = 0; r < rows.size(); r++) {
+      int cy = rows[r];
+      DensityTile& tile = tiles[ (uint64_t(cy / VIS_TILE) << 32) | uint64_t(col_x / VIS_TILE) ];
+      size_t before = tile.getBytes();
+      tile.Append ( uint16_t((col_x % VIS_TILE) * VIS_TILE + cy % VIS_TILE), &col[ size_t(cy) * VIS_CLASSES ] );
+      m_bytes += tile.getBytes() - before;
+      memset ( &col[ size_t(cy) * VIS_CLASSES ], 0, VIS_CLASSES * sizeof(uint32_t) );
+    }
+    rows.clear ();
+    return m_bytes <= VIS_TILE_MEM;
+  };
+  for (size_t n = 0; n < store.size(); n++) {
+    float u = float(store.getTime(n) - first_tm) / (float(SEC_PER_DAY) * m_days);
+    float v = visIP ( store.getIP(n) ) / 65536.0f;
+    int cx = std::max ( 0, std::min ( res - 1, int(u * res) ) );
+    int cy = std::max ( 0, std::min ( res - 1, res - 1 - int(v * res) ) );
+    if (cx != col_x) {
+      if (!flush ()) return false;
+      col_x = cx;
+    }
+    uint32_t* c = &col[ size_t(cy) * VIS_CLASSES ];
+    if ((c[0] | c[1] | c[2] | c[3]) == 0) rows.push_back ( cy );
+    c[ visClass(store.getBlock(n)) ]++;
+  }
+  if (!flush ()) return false;
+
+  DensityGrid sum;
+  for (int lev = fine - 1; lev >= 0; lev--) {
+    std::unordered_map<uint64_t, DensityTile>& child = m_tiles[lev+1];
+    std::unordered_map<uint64_t, DensityTile>::const_iterator it, ct;
+    for (it = child.begin(); it != child.end(); it++) {
+      uint32_t tx = uint32_t(it->first) / 2, ty = uint32_t(it->first >> 32) / 2;
+      uint64_t key = (uint64_t(ty) << 32) | tx;
+      if (m_tiles[lev].find ( key ) != m_tiles[lev].end()) continue;     // done from a sibling
+
+      // the up to four child tiles, into one grid
+      sum.Resize ( VIS_TILE, VIS_TILE );
+      for (int q = 0; q < 4; q++) {
+        ct = child.find ( (uint64_t(ty * 2 + q / 2) << 32) | (tx * 2 + q % 2) );
+        if (ct == child.end()) continue;
+        int ox = (q % 2) * VIS_TILE / 2, oy = (q / 2) * VIS_TILE / 2;
+        ct->second.forCells ( [&](int x, int y, const uint32_t* c) {
+          uint32_t* dst = sum.getCell ( ox + x / 2, oy + y / 2 );
+          for (int k = 0; k < VIS_CLASSES; k++) dst[k] += c[k];
+        });
+      }
+      DensityTile& parent = m_tiles[lev][key];
+      parent.FromGrid ( sum );
+      m_bytes += parent.getBytes();
+      if (m_bytes > VIS_TILE_MEM) return false;
+    }
+  }
+  return true;
+}
+
+void DensityPyramid::Render (Vec4F range, DensityGrid& out) const
+{
+  // coarsest level with cells no larger than an output pixel (or the finest level), each cell into its pixel
+  int xr = out.xres, yr = out.yres;
+  float days = range.z + 1 - range.x;
+  float subs = (range.w - range.y) * 256;
+  int lev = 0;
+  while (lev < m_levels - 1 && (float(VIS_TILE << lev) / m_days < xr / days || float(VIS_TILE << lev) / 65536.0f < yr / subs)) lev++;
+
+  int res = VIS_TILE << lev;
+  std::unordered_map<uint64_t, DensityTile>::const_iterator it;
+  for (it = m_tiles[lev].begin(); it != m_tiles[lev].end(); it++) {
+    int tx = int(uint32_t(it->first)) * VIS_TILE, ty = int(uint32_t(it->first >> 32)) * VIS_TILE;
+    it->second.forCells ( [&](int x, int y, const uint32_t* src) {
+      float ip = (1.0f - (ty + y + 0.5f) / res) * 65536.0f;
+      int py = int( yr - (ip - range.y*256) * yr / subs );
+      if (py < 0 || py >= yr) return;
+      float tm = (tx + x + 0.5f) / res * m_days;
+      int px = int( (tm - range.x) * xr / days );
+      if (px < 0 || px >= xr) return;
+      uint32_t* dst = out.getCell ( px, py );
+      for (int k = 0; k < VIS_CLASSES; k++) dst[k] += src[k];
+    });
+  }
+}
+
+int DensityPyramid::SaveTiles (std::string prefix, int levels) const
+{
+  // blocked view of every tile of the first levels, as <prefix><level>_<x>_<y>.png. one density scale per level
+  ImageX img;
+  DensityGrid grid;
+  int cnt = 0;
+  for (int lev = 0; lev < std::min ( levels, m_levels ); lev++) {
+    uint32_t maxcnt = 0;
+    std::unordered_map<uint64_t, DensityTile>::const_iterator it;
+    for (it = m_tiles[lev].begin(); it != m_tiles[lev].end(); it++) {
+      it->second.forCells ( [&maxcnt](int, int, const uint32_t* c) { maxcnt = std::max ( maxcnt, c[0] + c[1] + c[2] + c[3] ); } );
+    }
+    for (it = m_tiles[lev].begin(); it != m_tiles[lev].end(); it++) {
+      it->second.ToGrid ( grid );
+      img.Resize ( VIS_TILE, VIS_TILE, ImageOp::RGB8 );
+      img.Fill ( 255, 255, 255, 255 );
+      toneMap ( grid, maxcnt, 0x0, &img, 0x0 );
+      std::string name = prefix + iToStr(lev) + "_" + iToStr(int(uint32_t(it->first))) + "_" + iToStr(int(uint32_t(it->first >> 32))) + ".png";
+      img.Save ( name.c_str() );
+      cnt++;
+    }
+  }
+  return cnt;
+}
+
+void LogRip::BinHits (Vec4F range, uint32_t first_tm, size_t lo, size_t hi, DensityGrid& grid)
+{
+  // count hits m_Store[lo..hi) per pixel and class, in one parallel pass
+  // - the store is in time order so x never decreases. each thread takes a run of whole columns and owns their pixels
+  int xr = grid.xres, yr = grid.yres;
+  auto pixelX = [&](size_t n) -> int {
+    float tm = float(m_Store.getTime(n) - first_tm) / SEC_PER_DAY;
+    return int( (tm-range.x)*xr/(range.z+1-range.x) );
+  };
+  int num_threads = std::min ( getThreads(), std::max ( 1, int((hi - lo) >> 16) ) );
+  std::vector<size_t> split ( 1, lo );
+  for (int t = 1; t < num_threads; t++) {
+    size_t s = std::max ( split.back(), lo + (hi - lo) * t / num_threads );
+    while (s > lo && s < hi && pixelX(s) == pixelX(s-1)) s++;
+    split.push_back ( s );
+  }
+  split.push_back ( hi );
+
+  auto worker = [&](size_t a, size_t b) {
+    for (size_t n = a; n < b; n++) {
+      int x = pixelX ( n );
+      int y = int( yr - (visIP(m_Store.getIP(n))-range.y*256)*yr/((range.w-range.y)*256) );
+      if (x < 0 || x >= xr || y < 0 || y >= yr) continue;
+      grid.getCell ( x, y )[ visClass(m_Store.getBlock(n)) ]++;
+    }
+  };
+  if (num_threads == 1) {
+    worker ( lo, hi );
+  } else {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) workers.push_back ( std::thread ( worker, split[t], split[t+1] ) );
+    for (int t = 0; t < num_threads; t++) workers[t].join();
   }
-
-  fclose(fp);
 }
 
 void LogRip::OutputVis ()
@@ -1327,15 +4311,7 @@ void LogRip::OutputVis ()
   int show_min = 1;
   int show_max = 29;
 
-  // compute starting time
-  int first = 0;
-  float first_tm = 10e10;
-  for (int j = 0; j < m_Log.size(); j++) {
-    if (m_Log[j].date.GetDays() < first_tm) {
-      first = j;
-      first_tm = m_Log[j].date.GetDays();
-    }
-  }
+  uint32_t first_tm = m_Store.getFirst();
   m_img[I_ORIG].Fill(255, 255, 255, 255);
   m_img[I_BLOCKED].Fill(255, 255, 255, 255);
   m_img[I_FILTERED].Fill(255, 255, 255, 255);
@@ -1354,12 +4330,26 @@ void LogRip::OutputVis ()
     }
   }
 
-  for (int n = 0; n < m_Log.size(); n++) {
+  // hits in the zoomed days only
+  size_t lo, hi;
+  m_Store.getRange ( first_tm + uint32_t(range.x) * SEC_PER_DAY, first_tm + uint32_t(range.z + 1) * SEC_PER_DAY, lo, hi );
+
+  // density, counts per pixel tone mapped. from the pyramid when built, else binned from the hits
+  if ( getB(CONF_VIS_DENSITY) ) {
+    DensityGrid grid;
+    grid.Resize ( xr, yr );
+    if (m_Pyramid.getLevels() > 0) m_Pyramid.Render ( range, grid );
+    else                           BinHits ( range, first_tm, lo, hi, grid );
+    toneMap ( grid, 0, &m_img[I_ORIG], &m_img[I_BLOCKED], &m_img[I_FILTERED] );
+    lo = hi;
+  }
+
+  // dots, one per hit
+  for (size_t n = lo; n < hi; n++) {
 
-    LogInfo& i = m_Log[n];
     // get time & ip
-    float tm = i.date.GetDays() - first_tm;
-    Vec4F ipvec = ipToVec(i.ip);
+    float tm = float(m_Store.getTime(n) - first_tm) / SEC_PER_DAY;
+    Vec4F ipvec = ipToVec(m_Store.getIP(n));
     float ip = ipvec.x * 256 + ipvec.y + (ipvec.z / 256.0f);
     
     // graph point
@@ -1369,7 +4359,7 @@ void LogRip::OutputVis ()
     clr_block = Vec4F(128, 128, 128, 255);
 
     // set vis color based on blocking level
-    switch (i.block) {
+    switch (m_Store.getBlock(n)) {
     case 'B': clr_block.Set(0, 0, 255, 255); break;
     case 'C': clr_block.Set(255, 0, 255, 255); break;
     case 'I': clr_block.Set(255, 0, 0, 255); break;
@@ -1381,7 +4371,7 @@ void LogRip::OutputVis ()
     // blocked image - action taken
     m_img[I_BLOCKED].Dot(x, y, 3.0, clr_block);
     // filtered image - only those not blocked 
-    if (i.block==0) m_img[I_FILTERED].Dot(x, y, 3.0, black);
+    if (m_Store.getBlock(n)==0) m_img[I_FILTERED].Dot(x, y, 3.0, black);
   }
 
   m_img[I_ORIG].Save("out_fig1_orig.png");
@@ -1389,240 +4379,1310 @@ void LogRip::OutputVis ()
   m_img[I_FILTERED].Save("out_fig3_filtered.png");
 }
 
-void LogRip::OutputLoads (std::string filename)
+void LogRip::OutputLoads (std::string filename)
+{
+  int xr = m_img[0].GetWidth();
+  int yr = m_img[0].GetHeight();
+  m_img[I_ORIG].Fill(255, 255, 255, 255);
+
+  uint32_t first_tm = m_Store.getFirst();
+  float x, xl;
+  float y[7], yl[7];
+  int b;
+  uint32_t t;
+  Vec4F pal[7];
+  pal[0].Set(120, 120, 120, 255); // no blocking - grey
+  pal[1].Set(120,120,255,255);    // B net - blue
+  pal[2].Set(160,0,160,255);      // C net - purple 
+  pal[3].Set(0,255, 0, 255);      // all blocking - green
+  float load[7];
+  for (int k = 0; k < 4; k++) {
+    load[k] = 0;
+    yl[k] = 0;
+  }
+
+  // day grid
+  for (int d = 0; d < m_total_days; d++) {
+    x = d * xr / float(m_total_days);
+    for (int i = 0; i < I_NUM; i++) {
+      m_img[i].Line(x, 0, x, yr, Vec4F(0, 128, 0, 255));
+    }
+  }
+
+  // load duration per hit
+  // - this is the average server response time (impact) for a single hit
+  float load_duration = getF(CONF_LOAD_DURATION);   // in seconds
+  float vert_scale = getF(CONF_LOAD_SCALE);
+
+  // hit times by blocking class, sorted. 0 = all hits, 1 = B, 2 = C, 3 = I
+  // - the store is in time order, so all hits are read from it and each class keeps that order
+  std::vector<uint32_t> times[4];
+  size_t lo[4], hi[4], num[4];
+  for (size_t n = 0; n < m_Store.size(); n++) {
+    b = m_Store.getBlock(n);
+    if (b=='B') times[1].push_back ( m_Store.getTime(n) );
+    if (b=='C') times[2].push_back ( m_Store.getTime(n) );
+    if (b=='I') times[3].push_back ( m_Store.getTime(n) );
+  }
+  for (int k=0; k < 4; k++) lo[k] = hi[k] = 0;
+  for (int k=0; k < 4; k++) num[k] = (k == 0) ? m_Store.size() : times[k].size();
+  auto tm = [&](int k, size_t n) { return (k == 0) ? m_Store.getTime(n) : times[k][n]; };
+  
+  // plot 
+  // - sample times only increase with x, so the hits within +/- load_duration
+  //   are a window [lo,hi) that slides forward over each sorted list
+  xl = 0;
+  for (x = 0; x < xr; x++) {
+
+    // get real datetime for this x-coord
+    t = first_tm + int( x * float(m_total_days) / xr ) * SEC_PER_DAY;
+
+    for (int k=0; k <= 6; k++) y[k] = 0;    
+
+    // compute momentary load
+    float cnt[4];
+    for (int k=0; k < 4; k++) {
+      while (lo[k] < num[k] && float(elapsedSec( tm(k, lo[k]), t )) <= -load_duration) lo[k]++;
+      if (hi[k] < lo[k]) hi[k] = lo[k];
+      while (hi[k] < num[k] && float(elapsedSec( tm(k, hi[k]), t )) < load_duration) hi[k]++;
+      cnt[k] = float(hi[k] - lo[k]);     // hits within +/- load_duration
+    }
+    // increase load from all events, reduce load due to blocking
+    y[0] = cnt[0];
+    y[1] = y[0] - cnt[1];
+    y[2] = y[1] - cnt[2];
+    y[3] = y[2] - cnt[3];
+    
+    // accumulated load (all events)
+    for (int k = 0; k <= 4; k++) {
+      load[k] += y[k];					
+    }		
+
+    // plot loads
+    for (int k = 0; k <= 4; k++) {
+      y[k] = (yr-1) - y[k] * vert_scale;
+      m_img[I_ORIG].Line (x, yr, x, y[k], pal[k] );
+      yl[k] = y[k];
+    }	
+    xl = x;
+  }
+
+  m_img[I_ORIG].Save("out_load.png");
+}
+
+
+
+static std::string lookupAddr ( uint64_t ip )
+{
+  // address of an ip key as sent to the lookup server, subnets by their network address
+  std::string addr = ipToStr ( ip, isIPv6(ip) ? 64 : 32 );
+  return addr.substr ( 0, addr.find('/') );
+}
+
+#ifdef BUILD_OPENSSL
+static void lookupClean ( std::string& str )
+{
+  // results go into the tab-separated cache and unquoted csv output
+  for (size_t n = 0; n < str.size(); n++) {
+    if (str[n] == ',' || str[n] == '\t' || str[n] == '\n' || str[n] == '\r') str[n] = ' ';
+  }
+}
+
+static void jsonObjects ( const std::string& str, std::vector<std::string>& out )
+{
+  // split a json array of flat objects
+  int depth = 0;
+  bool quote = false;
+  size_t start = 0;
+  out.clear();
+  for (size_t n = 0; n < str.size(); n++) {
+    char c = str[n];
+    if (quote) {
+      if (c == '\\') n++;
+      else if (c == '"') quote = false;
+    } else if (c == '"') {
+      quote = true;
+    } else if (c == '{') {
+      if (depth++ == 0) start = n;
+    } else if (c == '}') {
+      if (--depth == 0) out.push_back ( str.substr ( start, n + 1 - start ) );
+    }
+  }
+}
+
+static std::string jsonValue ( const std::string& obj, const char* key )
+{
+  // value of a key in a flat json object, strings unescaped
+  std::string k = std::string("\"") + key + "\"";
+  size_t p = obj.find ( k );
+  if (p == std::string::npos) return "";
+  p += k.size();
+  while (p < obj.size() && (obj[p] == ' ' || obj[p] == ':')) p++;
+  std::string val;
+  if (p < obj.size() && obj[p] == '"') {
+    for (p++; p < obj.size() && obj[p] != '"'; p++) {
+      if (obj[p] != '\\' || p + 1 >= obj.size()) { val += obj[p]; continue; }
+      char e = obj[++p];
+      if (e == 'u' && p + 4 < obj.size()) {
+        // utf-8 from \uXXXX (basic plane)
+        uint32_t u = (uint32_t) strtoul ( obj.substr ( p + 1, 4 ).c_str(), 0x0, 16 );
+        p += 4;
+        if (u < 0x80)       { val += char(u); }
+        else if (u < 0x800) { val += char(0xC0 | (u >> 6)); val += char(0x80 | (u & 0x3F)); }
+        else                { val += char(0xE0 | (u >> 12)); val += char(0x80 | ((u >> 6) & 0x3F)); val += char(0x80 | (u & 0x3F)); }
+      } else {
+        val += (e == 'n' || e == 't' || e == 'r') ? ' ' : e;
+      }
+    }
+  } else {
+    while (p < obj.size() && obj[p] != ',' && obj[p] != '}') val += obj[p++];
+    val = strTrim ( val );
+  }
+  return val;
+}
+#endif
+
+void LookupService::LoadCache (std::string filename)
+{
+  // cache file, one line per ip: address, time, then the 10 lookup fields, tab-separated
+  m_cachefile = filename;
+  if (filename.empty()) return;
+  FILE* fp = fopen ( filename.c_str(), "rt" );
+  if (fp == 0x0) return;
+
+  char line[4096];
+  uint32_t expire = uint32_t(time(0)) - LOOKUP_CACHE_DAYS * 86400;
+  while (fgets ( line, sizeof(line), fp )) {
+    std::vector<std::string> f;
+    char* s = line;
+    for (char* c = line; ; c++) {
+      if (*c == '\t' || *c == '\n' || *c == '\r' || *c == '\0') {
+        f.push_back ( std::string ( s, c - s ) );
+        if (*c != '\t') break;
+        s = c + 1;
+      }
+    }
+    uint64_t ip;
+    if (f.size() != 12 || !ConvertIPKey ( f[0].c_str(), (int) f[0].size(), ip )) continue;
+    Entry& e = m_cache[ip];
+    e.time = (uint32_t) strtoul ( f[1].c_str(), 0x0, 10 );
+    for (int n = 0; n < 10; n++) e.lk.str[n] = f[n + 2];
+    if (e.time < expire) m_cache.erase ( ip );        // stale, look up again
+  }
+  fclose ( fp );
+}
+
+void LookupService::SaveCache ()
+{
+  if (m_cachefile.empty()) return;
+  std::string tmpfile = m_cachefile + ".tmp";
+  FILE* fp = fopen ( tmpfile.c_str(), "wt" );
+  if (fp == 0x0) {
+    printf ( "**** WARNING: Unable to write lookup cache %s.\n", tmpfile.c_str() );
+    return;
+  }
+  std::unordered_map<uint64_t, Entry>::iterator it;
+  for (it = m_cache.begin(); it != m_cache.end(); it++) {
+    fprintf ( fp, "%s\t%u", lookupAddr ( it->first ).c_str(), it->second.time );
+    for (int n = 0; n < 10; n++) fprintf ( fp, "\t%s", it->second.lk.str[n].c_str() );
+    fprintf ( fp, "\n" );
+  }
+  fclose ( fp );
+  remove ( m_cachefile.c_str() );
+  rename ( tmpfile.c_str(), m_cachefile.c_str() );
+}
+
+const IPLookup* LookupService::Find (uint64_t ip) const
+{
+  std::unordered_map<uint64_t, Entry>::const_iterator it = m_cache.find ( ip );
+  return (it == m_cache.end()) ? 0x0 : &it->second.lk;
+}
+
+void LookupService::Start (std::string host, float per_min, std::vector<uint64_t>& ips)
+{
+  // look up ips not in the cache, in the background
+  m_host = host;
+  m_pending.clear();
+  for (size_t n = 0; n < ips.size(); n++) {
+    if (m_cache.find ( ips[n] ) == m_cache.end()) m_pending.push_back ( ips[n] );
+  }
+  std::sort ( m_pending.begin(), m_pending.end() );
+  m_pending.erase ( std::unique ( m_pending.begin(), m_pending.end() ), m_pending.end() );
+  if (m_pending.empty()) return;
+
+  #ifdef BUILD_OPENSSL
+    // bucket holds a minute of batches, as the endpoint limit is per minute
+    m_rate = std::max ( per_min, 0.1f ) / 60.0;
+    m_burst = std::max ( 1.0, floor ( double(per_min) ) );
+    m_tokens = m_burst;
+    m_last = std::chrono::steady_clock::now();
+    m_thread = std::thread ( &LookupService::Run, this );
+  #else
+    (void) per_min;
+    printf ( "**** WARNING: Remote lookup needs BUILD_OPENSSL. Only cached results used.\n" );
+    m_pending.clear();
+  #endif
+}
+
+void LookupService::Finish ()
+{
+  if (m_thread.joinable()) {
+    m_thread.join();
+    SaveCache ();
+  }
+}
+
+void LookupService::TakeToken ()
+{
+  // wait until a whole token is in the bucket
+  for (;;) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    m_tokens = std::min ( m_burst, m_tokens + m_rate * std::chrono::duration<double>( now - m_last ).count() );
+    m_last = now;
+    if (m_tokens >= 1.0) break;
+    std::this_thread::sleep_for ( std::chrono::duration<double>( (1.0 - m_tokens) / m_rate ) );
+  }
+  m_tokens -= 1.0;
+}
+
+void LookupService::Run ()
+{
+  int retries = 0, wait;
+  for (size_t n = 0; n < m_pending.size(); ) {
+    size_t cnt = std::min ( (size_t) LOOKUP_BATCH, m_pending.size() - n );
+    std::vector<uint64_t> batch ( m_pending.begin() + n, m_pending.begin() + n + cnt );
+    TakeToken ();
+    bool ok = RequestBatch ( batch, wait );
+    if (wait < 0) break;                      // server not usable
+    if (wait > 0) std::this_thread::sleep_for ( std::chrono::seconds( wait ) );
+    if (!ok && ++retries <= LOOKUP_RETRIES) continue;
+    n += cnt;
+    retries = 0;
+  }
+}
+
+bool LookupService::RequestBatch (const std::vector<uint64_t>& ips, int& wait)
+{
+  // one POST of a json array of addresses, results come back in the same order
+  // - wait is set to the seconds to hold off before the next batch, -1 to stop
+  wait = -1;
+  #ifdef BUILD_OPENSSL
+    std::string body = "[";
+    for (size_t n = 0; n < ips.size(); n++) body += (n ? ",\"" : "\"") + lookupAddr ( ips[n] ) + "\"";
+    body += "]";
+
+    httplib::Client cli ( m_host );
+    cli.set_connection_timeout ( 5 );
+    cli.set_read_timeout ( 15 );
+    auto res = cli.Post ( "/batch?fields=status,country,regionName,city,zip,lat,lon,isp,org,asname", body, "application/json" );
+    if (!res) {
+      printf ( "**** WARNING: Lookup server %s not reachable. Lookups stopped.\n", m_host.c_str() );
+      return false;
+    }
+    // rate limit headers: requests left in the window, seconds until it resets
+    int ttl = res->has_header("X-Ttl") ? strToI ( res->get_header_value("X-Ttl") ) : 60;
+    wait = (res->has_header("X-Rl") && strToI ( res->get_header_value("X-Rl") ) == 0) ? ttl + 1 : 0;
+    if (res->status == 429) {
+      wait = ttl + 1;
+      return false;
+    }
+    if (res->status != StatusCode::OK_200) {
+      printf ( "**** WARNING: Lookup server returned %d. Lookups stopped.\n", res->status );
+      wait = -1;
+      return false;
+    }
+
+    static const char* fields[10] = { "status", "country", "regionName", "city", "zip", "lat", "lon", "isp", "org", "asname" };
+    std::vector<std::string> objs;
+    jsonObjects ( res->body, objs );
+    uint32_t now = (uint32_t) time(0);
+    for (size_t n = 0; n < objs.size() && n < ips.size(); n++) {
+      Entry& e = m_cache[ ips[n] ];
+      e.time = now;
+      for (int k = 0; k < 10; k++) {
+        e.lk.str[k] = jsonValue ( objs[n], fields[k] );
+        lookupClean ( e.lk.str[k] );
+      }
+    }
+    return true;
+  #else
+    (void) ips;
+    return false;
+  #endif
+}
+
+void LogRip::StartLookups ()
+{
+  // look up the blocked IPs and subnets, while the other outputs are written
+  if (!getB(CONF_LOOKUP)) return;
+  m_Lookup.LoadCache ( getStr(CONF_LOOKUP_CACHE) );
+
+  static const char action[SUB_MAX] = { 0, 'B', 'C', 'I' };
+  std::vector<uint64_t> ips;
+  for (int lev = SUB_B; lev <= SUB_D; lev++) {
+    IPTable& list = m_IPList[lev];
+    for (size_t n = 0; n < list.size(); n++) {
+      if (list[n].block == action[lev]) ips.push_back ( list[n].ip );
+    }
+  }
+  m_Lookup.Start ( getStr(CONF_LOOKUP_HOST), getF(CONF_LOOKUP_RATE), ips );
+  if (m_Lookup.numPending() > 0) {
+    dbgprintf ( "Looking up %d IPs in the background.\n", (int) m_Lookup.numPending() );
+  }
+}
+
+void LogRip::FinishLookups ()
+{
+  // wait for the lookups, attach the results to every record with that address
+  if (!getB(CONF_LOOKUP)) return;
+  if (m_Lookup.numPending() > 0) dbgprintf ( "Waiting for lookups.\n" );
+  m_Lookup.Finish ();
+
+  for (int lev = SUB_A; lev < SUB_MAX; lev++) {
+    IPTable& list = m_IPList[lev];
+    for (size_t n = 0; n < list.size(); n++) {
+      const IPLookup* lk = m_Lookup.Find ( list[n].ip );
+      if (lk != 0x0) list.setLookup ( list[n].ip ) = *lk;
+    }
+  }
+}
+
+void LogRip::OutputIP (CSVWriter& out, IPInfo* f)
+{
+  // print ip info
+  static IPLookup no_lookup, geo_lookup;
+  IPLookup* lk;
+
+  lk = m_IPList[f->lev].getLookup ( f->ip );
+  if (lk == 0x0) lk = &no_lookup;
+
+  const char* pagename = "";
+  if (f->lev == 3 && f->page_cnt > 0) { pagename = m_Pages.getStr( m_Log[ FirstHit(f) ].page ); }
+
+  // org and country from the remote lookup, else from the geo database
+  if (lk->str[L_ORG].empty() && f->geo != 0) {
+    lk = &geo_lookup;
+    lk->str[L_ORG] = "AS" + std::to_string( m_Geo.getASN(f->geo) ) + " " + m_Geo.getOrg(f->geo);
+    lk->str[L_COUNTRY] = m_Geo.getCountry(f->geo);
+  }
+
+  // "%s, %d, %d, %d, %.2f, %.2f, %d, %d, %f, %f, %f, %f, %f, %f, %s, %s, %s, %s\n"
+  out.IP ( f->ip, getBits(f->ip, f->lev) ); out.Str ( ", ", 2 );
+  OutputMetrics ( out, f );
+  out.Str ( lk->str[L_ORG] );         out.Str ( ", ", 2 );
+  out.Str ( lk->str[L_REGION] );      out.Str ( ", ", 2 );
+  out.Str ( lk->str[L_COUNTRY] );     out.Str ( ", ", 2 );
+  out.Str ( pagename );               out.Char ( '\n' );
+}
+
+void LogRip::OutputMetrics (CSVWriter& out, IPInfo* f)
+{
+  // metric columns, ip_cnt to max_ppm
+  float uniq_ratio = (f->page_cnt > 0) ? ((float)f->uniq_cnt / f->page_cnt) : 0.0f;
+
+  out.Int ( f->ip_cnt );              out.Str ( ", ", 2 );
+  out.Int ( f->page_cnt );            out.Str ( ", ", 2 );
+  out.Int ( f->uniq_cnt );            out.Str ( ", ", 2 );
+  out.Float ( uniq_ratio, 2 );        out.Str ( ", ", 2 );
+  out.Float ( f->elapsed, 2 );        out.Str ( ", ", 2 );
+  out.Int ( f->max_consecutive );     out.Str ( ", ", 2 );
+  out.Int ( f->num_robots );          out.Str ( ", ", 2 );
+  out.Float ( f->daily_min_hit );     out.Str ( ", ", 2 );
+  out.Float ( f->daily_min_range/60.0 ); out.Str ( ", ", 2 );
+  out.Float ( f->daily_min_ppm );     out.Str ( ", ", 2 );
+  out.Float ( f->daily_max_hit );     out.Str ( ", ", 2 );
+  out.Float ( f->daily_max_range/60.0 ); out.Str ( ", ", 2 );
+  out.Float ( f->daily_max_ppm );     out.Str ( ", ", 2 );
+}
+
+int LogRip::OutputIPs (int outlev, std::string filename )
+{	
+  CSVWriter out;
+  if (!out.Open ( filename )) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }	
+  // header 	
+  out.Str ( "IP, ip_cnt, page_cnt, uniq_cnt, uniq_ratio, elapsed(days), max_consec, num_robot, min_hit, min_hr, min_ppm, max_hit, max_hr, max_ppm, org, region, country, page\n" );
+
+  // every level is sorted by ip, and every subnet contains all of its children,
+  // so the A > B > C > D hierarchy in order is just the output level in order
+  IPTable& list = m_IPList[outlev];
+  for (size_t n = 0; n < list.size(); n++) {
+    OutputIP ( out, &list[n] );
+  }
+  out.Close ();
+
+  return (int) list.size();
+}
+
+int LogRip::OutputASNs (std::string filename )
+{
+  CSVWriter out;
+  if (!out.Open ( filename )) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }
+  out.Str ( "ASN, ip_cnt, page_cnt, uniq_cnt, uniq_ratio, elapsed(days), max_consec, num_robot, min_hit, min_hr, min_ppm, max_hit, max_hr, max_ppm, blocked_ips, org, country\n" );
+
+  // blocked IPs per ASN
+  std::unordered_map<uint32_t, int> blocked;
+  IPTable& ips = m_IPList[SUB_D];
+  for (size_t n = 0; n < ips.size(); n++) {
+    if (ips[n].geo != 0 && ips[n].block != 0) blocked[ m_Geo.getASN( ips[n].geo ) ]++;
+  }
+
+  for (size_t n = 0; n < m_ASNList.size(); n++) {
+    IPInfo* f = &m_ASNList[n];
+    out.Str ( "AS", 2 );                out.Int ( (long long) f->ip );  out.Str ( ", ", 2 );
+    OutputMetrics ( out, f );
+    out.Int ( blocked[ (uint32_t) f->ip ] ); out.Str ( ", ", 2 );
+    out.Str ( m_Geo.getOrg(f->geo) );   out.Str ( ", ", 2 );
+    out.Str ( m_Geo.getCountry(f->geo) ); out.Char ( '\n' );
+  }
+  out.Close ();
+
+  return (int) m_ASNList.size();
+}
+
+int LogRip::OutputRates (std::string filename )
+{
+  // IPs and subnets flagged by the rolling rates, with the time first flagged and the peak rates
+  CSVWriter out;
+  if (!out.Open ( filename )) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }
+  out.Str ( "IP, flagged, reason, blocked, hits, robots, uniq_est, peak_ppm_1m, peak_ppm_10m, peak_ppm_60m, peak_day_hits, last\n" );
+
+  int cnt = 0;
+  for (int lev = SUB_B; lev <= SUB_D; lev++) {
+    IPTable& list = m_IPList[lev];
+    for (size_t n = 0; n < list.size(); n++) {
+      IPInfo* f = &list[n];
+      RateState& r = list.getRate ( f );
+      if (r.score == 0) continue;
+      out.IP ( f->ip, getBits(f->ip, f->lev) );         out.Str ( ", ", 2 );
+      out.Str ( writeTime(r.flag_time) );               out.Str ( ", ", 2 );
+      out.Str ( scoreReason(r.score) );                 out.Str ( ", ", 2 );
+      out.Char ( f->block ? f->block : '-' );           out.Str ( ", ", 2 );
+      out.Int ( r.hits );                               out.Str ( ", ", 2 );
+      out.Int ( r.robots );                             out.Str ( ", ", 2 );
+      out.Int ( (long long) (r.getUniq() + 0.5f) );     out.Str ( ", ", 2 );
+      out.Float ( r.peak[RATE_1M] * 60.0f / rate_secs[RATE_1M], 2 );    out.Str ( ", ", 2 );
+      out.Float ( r.peak[RATE_10M] * 60.0f / rate_secs[RATE_10M], 2 );  out.Str ( ", ", 2 );
+      out.Float ( r.peak[RATE_60M] * 60.0f / rate_secs[RATE_60M], 2 );  out.Str ( ", ", 2 );
+      out.Float ( r.peak[RATE_DAY], 1 );                out.Str ( ", ", 2 );
+      out.Str ( writeTime(r.last) );                    out.Char ( '\n' );
+      cnt++;
+    }
+  }
+  out.Close ();
+  return cnt;
+}
+
+int LogRip::OutputTop (std::string filename )
+{
+  // most hit pages and most active IPs, counts are high by at most the error
+  CSVWriter out;
+  if (!out.Open ( filename )) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }
+  out.Str ( "rank, type, hits, error, key\n" );
+
+  std::vector<TopCount> top;
+  int num = getI(CONF_SKETCH_TOP);
+  m_TopIPs.getTop ( num, top );
+  for (size_t n = 0; n < top.size(); n++) {
+    out.Int ( n + 1 );            out.Str ( ", ip, ", 6 );
+    out.Int ( top[n].cnt );       out.Str ( ", ", 2 );
+    out.Int ( top[n].err );       out.Str ( ", ", 2 );
+    out.IP ( top[n].key, getBits(top[n].key, SUB_D) );  out.Char ( '\n' );
+  }
+  m_TopPages.getTop ( num, top );
+  for (size_t n = 0; n < top.size(); n++) {
+    out.Int ( n + 1 );            out.Str ( ", page, ", 8 );
+    out.Int ( top[n].cnt );       out.Str ( ", ", 2 );
+    out.Int ( top[n].err );       out.Str ( ", ", 2 );
+    out.Str ( m_Pages.getStr( uint32_t(top[n].key) ), m_Pages.getLen( uint32_t(top[n].key) ) );  out.Char ( '\n' );
+  }
+  out.Close ();
+  return (int) top.size();
+}
+
+void LogRip::OutputPages (std::string filename)
+{
+  CSVWriter out;
+  if (!out.Open ( filename )) {
+    dbgprintf("ERROR: Unable to open %s for writing.\n", filename.c_str());
+    exit(-1);
+  }
+  // header		
+  out.Str ( "IP, pages, cnt, page\n" );
+
+  IPTable& list = m_IPList[SUB_D];
+  std::vector<uint32_t> pages;                              // unique pages of one IP
+  std::vector<uint32_t> page_cnt ( m_Pages.Count(), 0 );    // hits per page
+  IPScratch scr;
+
+  for (size_t i = 0; i < list.size(); i++) {
+
+    IPInfo& f = list[i];
+
+    // count hits per unique page
+    pages.clear ();
+    GatherHits ( &f, scr );
+    for (size_t j = 0; j < scr.order.size(); j++) {
+      uint32_t page = m_Log[ scr.order[j] ].page;
+      if (page_cnt[ page ]++ == 0) pages.push_back ( page );
+    }
+    // sort unique pages by name 
+    SortPagesByName(pages);
+
+    out.IP ( f.ip, getBits(f.ip, SUB_D) ); out.Str ( ", ", 2 ); out.Int ( f.page_cnt ); out.Str ( ",,\n", 3 );
+
+    // list unique pages
+    for (size_t n = 0; n < pages.size(); n++) {
+      out.Str ( ",,", 2 ); out.Int ( page_cnt[ pages[n] ] ); out.Char ( ',' );
+      out.Str ( m_Pages.getStr( pages[n] ), m_Pages.getLen( pages[n] ) ); out.Char ( '\n' );
+      page_cnt[ pages[n] ] = 0;
+    }
+  }
+  out.Close ();
+}
+
+
+void LogRip::ComputeAll ()
+{
+  // construct IP hash from all page hits
+  dbgprintf("Construct IP Hash.\n");
+  StageBegin();
+  ConstructIPHash();
+  StageEnd("ConstructIPHash", m_Log.size());
+
+  // find start and end date range
+  dbgprintf("Preparing Days.\n");
+  StageBegin();
+  PrepareDays();
+  StageEnd("PrepareDays", m_DayList.size());
+
+  // sort all IPs and hits by date, compute metrics & scores
+  dbgprintf("Processing IPs.\n");
+  StageBegin();
+  ProcessIPs(SUB_D);
+  StageEnd("ProcessIPs D", m_IPList[SUB_D].size());
+
+  // build Class C-subnets by aggregation
+  dbgprintf("Constructing C-Subnets.\n");
+  StageBegin();
+  ConstructSubnet(SUB_D, SUB_C);
+  StageEnd("ConstructSubnet C", m_IPList[SUB_D].size());
+
+  // build Class B-subnets by aggregation
+  dbgprintf("Constructing B-Subnets.\n");
+  StageBegin();
+  ConstructSubnet(SUB_C, SUB_B);
+  StageEnd("ConstructSubnet B", m_IPList[SUB_C].size());
+
+  // build Class A-subnets by aggregation
+  dbgprintf("Constructing A-Subnets.\n");
+  StageBegin();
+  ConstructSubnet(SUB_B, SUB_A);
+  StageEnd("ConstructSubnet A", m_IPList[SUB_B].size());
+
+  // sort all C-subnet IPs and hits by date, compute metrics & score
+  dbgprintf("Processing IPs. C-Subnets.\n");
+  StageBegin();
+  ProcessIPs(SUB_C);
+  StageEnd("ProcessIPs C", m_IPList[SUB_C].size());
+
+  // sort all B-subnet IPs and hits by date, compute metrics & score
+  dbgprintf("Processing IPs. B-Subnets.\n");
+  StageBegin();
+  ProcessIPs(SUB_B);
+  StageEnd("ProcessIPs B", m_IPList[SUB_B].size());
+
+  // most hit pages and most active IPs
+  if ( getB(CONF_SKETCH) ) {
+    dbgprintf("Counting top pages and IPs.\n");
+    StageBegin();
+    ComputeTop(0, m_Log.size());
+    StageEnd("ComputeTop", m_Log.size());
+  }
+
+  // compute blocklist hierarchically for most compact list
+  dbgprintf("Computing Blocklist.\n");
+  StageBegin();
+  ComputeBlocklist();
+  StageEnd("ComputeBlocklist", m_IPList[SUB_D].size());
+}
+
+void LogRip::FollowLog (std::string filename)
 {
-  int xr = m_img[0].GetWidth();
-  int yr = m_img[0].GetHeight();
-  m_img[I_ORIG].Fill(255, 255, 255, 255);
+  // follow mode
+  // - keep reading lines appended to the log, also across rotation (a new file at the same path)
+  // - new hits are folded into the IP levels, only the IPs and subnets they touch are recomputed
+  // - out_blocklist.txt is rewritten whenever the blocklist changes
+  LogFormat fmt;
+  fmt.Compile ( getStr( CONF_FORMAT ) );
+
+  LoadProgress prog;
+  prog.total = 0;             // no progress report or format check
+  prog.percl = 0;
+  prog.done = 0;
+  prog.hits = 0;
+  prog.skipped = 0;
+
+  std::string blocklist = BuildBlocklist ();
+  std::vector<char> buf ( 1 << 20 );
+  size_t have = 0, cut, n, start;
+  bool rotated;
+  int poll_ms = std::max ( 10, int( getF(CONF_FOLLOW_POLL) * 1000 ) );
+
+  printf ( "Following log: %s\n", filename.c_str() );
+
+  FILE* fp = fopen ( filename.c_str(), "rb" );
+  if (fp != 0x0) fseek64 ( fp, m_log_pos, SEEK_SET );
+
+  for (;;) {
+
+    // find rotation (new file at the path) or truncation
+    rotated = false;
+    if (fp == 0x0) {
+      fp = fopen ( filename.c_str(), "rb" );      // missing during rotation
+      m_log_pos = 0;
+      have = 0;
+    } else {
+      #ifndef _WIN32
+        struct stat cur, now;
+        if (stat ( filename.c_str(), &now ) == 0 && fstat ( fileno(fp), &cur ) == 0 &&
+            (now.st_ino != cur.st_ino || now.st_dev != cur.st_dev)) rotated = true;
+      #endif
+      fseek64 ( fp, 0, SEEK_END );
+      if (size_t( ftell64(fp) ) < m_log_pos) { m_log_pos = 0; have = 0; }   // truncated, start over
+      fseek64 ( fp, m_log_pos, SEEK_SET );
+    }
 
-  int first = 0;
-  float first_tm = 10e10;
+    // read and parse all complete new lines
+    start = m_Log.size();
+    if (fp != 0x0) {
+      for (;;) {
+        if (buf.size() - have < (64 << 10)) buf.resize ( buf.size() * 2 );
+        n = fread ( &buf[0] + have, 1, buf.size() - have, fp );
+        if (n == 0) break;
+        have += n;
+        m_log_pos += n;
+      }
+      cut = have;
+      if (!rotated) {
+        while (cut > 0 && buf[cut-1] != '\n') cut--;     // rotated file is complete, parse all
+      }
+      if (cut > 0) {
+        ParseBlock ( fmt, &buf[0], cut, prog );
+        memmove ( &buf[0], &buf[0] + cut, have - cut );
+        have -= cut;
+      }
+      if (rotated) {
+        fclose ( fp );
+        fp = fopen ( filename.c_str(), "rb" );
+        m_log_pos = 0;
+        have = 0;
+      }
+    }
 
-  for (int j = 0; j < m_Log.size(); j++) {
-    if (m_Log[j].date.GetDays() < first_tm) {
-      first = j;
-      first_tm = m_Log[j].date.GetDays();
+    // update IPs and blocklist
+    if (m_Log.size() > start) {
+      uint32_t last = m_Log.back().time;
+      int cnt = UpdateHits ( start );
+      ComputeBlocklist ();
+
+      std::string list = BuildBlocklist ();
+      bool changed = (list != blocklist);
+      if (changed) {
+        OutputBlocklist ( "out_blocklist.txt" );
+        blocklist = list;
+      }
+      printf ( "Follow: %s, +%d hits, %d IPs updated.%s\n", writeTime( last ).c_str(), int(m_Log.size() - start), cnt, changed ? " Blocklist written." : "" );
+      fflush ( stdout );
     }
+
+    std::this_thread::sleep_for ( std::chrono::milliseconds( poll_ms ) );
   }
-  float ds, x, xl;
-  float y[7], yl[7];
-  int b;
-  TimeX t;
-  Vec4F pal[7];
-  pal[0].Set(120, 120, 120, 255); // no blocking - grey
-  pal[1].Set(120,120,255,255);    // B net - blue
-  pal[2].Set(160,0,160,255);      // C net - purple 
-  pal[3].Set(0,255, 0, 255);      // all blocking - green
-  float load[7];
-  for (int k = 0; k < 4; k++) {
-    load[k] = 0;
-    yl[k] = 0;
-  }
+}
 
-  // day grid
-  for (int d = 0; d < m_total_days; d++) {
-    x = d * xr / float(m_total_days);
-    for (int i = 0; i < I_NUM; i++) {
-      m_img[i].Line(x, 0, x, yr, Vec4F(0, 128, 0, 255));
+int LogRip::UpdateHits (size_t start)
+{
+  // fold new hits m_Log[start..] into the IP levels
+  // - hits stay after the sorted base of m_Log, each IP and subnet lists its new hits by time
+  // - new IPs and subnets are merged into the levels in order
+  // - only touched IPs and subnets are recomputed, the A level is not kept up to date
+  // - once the new hits grow large (or reach before the first day) everything is compacted
+  size_t num = m_Log.size() - m_base_hits;
+  bool compact = (num > std::max ( m_base_hits / 4, size_t(1 << 20) ));
+  for (size_t n = start; n < m_Log.size(); n++) {
+    uint32_t t = m_Log[n].time;
+    if (t < m_time_min) compact = true;
+    while (t > m_time_max) {
+      m_DayList.push_back ( DayInfo( unpackTime(m_time_max + 1) ) );
+      m_time_max += SEC_PER_DAY;
+      m_total_days++;
     }
   }
+  if (compact) {
+    Compact ();
+    return (int) m_IPList[SUB_D].size();
+  }
+  if ( getB(CONF_SKETCH) ) ComputeTop ( start, m_Log.size() );
 
-  // load duration per hit
-  // - this is the average server response time (impact) for a single hit
-  float load_duration = getF(CONF_LOAD_DURATION);   // in seconds
-  float vert_scale = getF(CONF_LOAD_SCALE);
-  
-  // plot 
-  xl = 0;
-  for (x = 0; x < xr; x++) {
+  std::vector<uint64_t> keys;
+  std::vector<IPInfo> add;
+  std::vector<IPInfo*> ips;
+  int cnt = 0;
 
-    // get real datetime for this x-coord
-    t = m_Log[first].date;
-    t.AdvanceDays ( x * float(m_total_days) / xr );
+  for (int lev = SUB_D; lev >= SUB_B; lev--) {
 
-    for (int k=0; k <= 6; k++) y[k] = 0;    
+    IPTable& list = m_IPList[lev];
 
-    // compute momentary load
-    for (int n=0; n < m_Log.size(); n++) {			
-      ds = m_Log[n].date.GetElapsedSec( t );			// delta in seconds
-      b = m_Log[n].block;
-      if (fabs(ds) < load_duration) {
-        // increase load from this event
-        for (int k=0; k < 4; k++) y[k]++;		
-        // reduce load due to blocking	
-        if (b > 0 ) {
-          if (b=='B') {y[1]--; y[2]--; y[3]--;}
-          if (b=='C') {y[2]--; y[3]--;}
-          if (b=='I') {y[3]--;}
-        }
+    // add hits to the delta lists
+    AddDelta ( start, lev, keys );
+
+    // new IPs or subnets
+    add.clear ();
+    for (size_t k = 0; k < keys.size(); k++) {
+      if (list.Find ( keys[k] ) == 0x0) {
+        IPInfo i = IPInfo();
+        i.lev = lev;
+        i.ip = keys[k];
+        add.push_back ( i );
       }
-    }	
-    
-    // accumulated load (all events)
-    for (int k = 0; k <= 4; k++) {
-      load[k] += y[k];					
-    }		
+    }
+    list.Merge ( add );
+
+    // refresh the touched entries
+    ips.clear ();
+    for (size_t k = 0; k < keys.size(); k++) {
+      IPInfo* f = list.Find ( keys[k] );
+      std::vector<size_t>& delta = m_Delta[lev][ keys[k] ];
+
+      if (lev == SUB_D) {
+        uint32_t ts = m_Log[ delta.front() ].time, te = m_Log[ delta.back() ].time;
+        f->ip_cnt = 1;
+        f->page_cnt = f->base_cnt + (int) delta.size();
+        f->start_time = (f->base_cnt > 0) ? std::min ( m_Log[f->first].time, ts ) : ts;
+        f->end_time = (f->base_cnt > 0) ? std::max ( m_Log[f->first + f->base_cnt - 1].time, te ) : te;
+      } else {
+        RefreshSubnet ( f );
+      }
+      ips.push_back ( f );
+    }
 
-    // plot loads
-    for (int k = 0; k <= 4; k++) {
-      y[k] = (yr-1) - y[k] * vert_scale;
-      m_img[I_ORIG].Line (x, yr, x, y[k], pal[k] );
-      yl[k] = y[k];
-    }	
-    xl = x;
+    // recompute metrics & scores
+    ProcessList ( ips );
+    cnt += (int) ips.size();
   }
-
-  m_img[I_ORIG].Save("out_load.png");
+  return cnt;
 }
 
+void LogRip::AddDelta (size_t start, int lev, std::vector<uint64_t>& keys)
+{
+  // add hits m_Log[start..] to the delta lists of one level, keys are the touched IPs or subnets
+  keys.clear ();
+  for (size_t n = start; n < m_Log.size(); n++) {
+    uint64_t key = getMaskedIP ( m_Log[n].ip, lev );
+    m_Delta[lev][key].push_back ( n );
+    keys.push_back ( key );
+  }
+  std::sort ( keys.begin(), keys.end() );
+  keys.erase ( std::unique ( keys.begin(), keys.end() ), keys.end() );
 
+  // keep lists by time
+  for (size_t k = 0; k < keys.size(); k++) {
+    std::vector<size_t>& delta = m_Delta[lev][ keys[k] ];
+    std::stable_sort ( delta.begin(), delta.end(), [this](size_t a, size_t b) { return m_Log[a].time < m_Log[b].time; } );
+  }
+}
 
-void LogRip::LookupName (IPInfo* f)
+size_t LogRip::FirstHit (IPInfo* f)
 {
-  #ifdef BUILD_OPENSSL
-    // lookup IP 
-    // HTTP		
-    httplib::Client cli("http://ip-api.com");	
-    std::string ipstr = "/line/" + ipToStr(f->pages[0].ip) + "?fields=status,country,regionName,city,zip,lat,long,isp,org,asname";
-    auto res = cli.Get(ipstr.c_str());
-    if (res->status == StatusCode::OK_200) {
-      // parse out the 10 result strings: status,country,regionName,city,zip,lat,long,isp,org,asname
-      std::string str = res->body;
-      for (int n = 0; n < 10; n++) {
-        f->lookup[n] = strSplitLeft(str, "\n");
-      }
+  // earliest hit of an IP, from the base range or the delta list
+  assert ( f->lev >= SUB_A && f->lev < SUB_MAX );
+  if (f->lev >= SUB_MAX) return f->first;
+  std::unordered_map< uint64_t, std::vector<size_t> >::const_iterator it = m_Delta[f->lev].find ( f->ip );
+  if (it == m_Delta[f->lev].end()) return f->first;
+  size_t d = it->second.front();
+  return (f->base_cnt > 0 && m_Log[f->first].time <= m_Log[d].time) ? f->first : d;
+}
+
+void LogRip::RefreshSubnet (IPInfo* f)
+{
+  // aggregate a subnet from its IPs, a contiguous run of the D level
+  IPTable& list = m_IPList[SUB_D];
+  uint64_t mask = getMask ( f->ip, f->lev );
+  uint64_t net = f->ip & mask;
+
+  f->ip_cnt = 0;
+  f->page_cnt = 0;
+  f->base_cnt = 0;
+  UniqSketch* uniq = getB(CONF_SKETCH) ? &m_IPList[f->lev].getUniq ( f ) : 0x0;
+  if (uniq) uniq->Clear ();
+  for (size_t n = list.LowerBound ( net ); n < list.size() && (list[n].ip & mask) == net; n++) {
+    IPInfo& i = list[n];
+    if (uniq) uniq->Merge ( list.getUniq ( &i ) );
+    if (f->ip_cnt == 0) {
+      f->start_time = i.start_time;
+      f->end_time = i.end_time;
     }
+    if (f->base_cnt == 0) f->first = i.first;     // range starts at the first IP with base hits
+    f->base_cnt += i.base_cnt;
+    f->page_cnt += i.page_cnt;
+    f->ip_cnt++;
+    if (i.start_time < f->start_time)	f->start_time = i.start_time;
+    if (i.end_time > f->end_time)		f->end_time = i.end_time;
+  }
+  f->elapsed = elapsedDays(f->end_time, f->start_time);
+}
+
+void LogRip::Compact ()
+{
+  // fold all hits into a new sorted base and recompute all levels
+  printf ( "Compacting %d hits.\n", (int) m_Log.size() );
+  for (int lev = 0; lev < SUB_MAX; lev++) {
+    m_IPList[lev].Clear ();
+    m_Delta[lev].clear ();
+  }
+  m_DayList.clear ();
+  m_Pages.BuildRanks ();
+  ComputeAll ();
+}
 
-    #ifdef _WIN32
-      Sleep(1500);   // ip-api, "This endpoint is limited to 45 queries per minute from an IP address"	
+size_t getPeakRSS ()
+{
+  // peak resident memory of the process, bytes
+  #ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (K32GetProcessMemoryInfo ( GetCurrentProcess(), &pmc, sizeof(pmc) )) return pmc.PeakWorkingSetSize;
+    return 0;
+  #else
+    struct rusage ru;
+    getrusage ( RUSAGE_SELF, &ru );
+    #ifdef __APPLE__
+      return size_t(ru.ru_maxrss);            // bytes on macos
     #else
-      sleep(1500);
+      return size_t(ru.ru_maxrss) * 1024;     // kilobytes on linux
     #endif
   #endif
 }
 
-int LogRip::OutputIPs(int outlev, int lev, uint32_t parent, FILE* fp)
+size_t getCurrentRSS ()
 {
-  IPMap_iter it;
-  IPMap_t& list = m_IPList[lev];
-  IPInfo* f;
-  int cnt = 0;
-
-  for (it = list.begin(); it != list.end(); it++) {
+  // resident memory of the process now, bytes (0 where not known)
+  #ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (K32GetProcessMemoryInfo ( GetCurrentProcess(), &pmc, sizeof(pmc) )) return pmc.WorkingSetSize;
+    return 0;
+  #elif defined(__linux__)
+    long size = 0, pages = 0;
+    FILE* fp = fopen ( "/proc/self/statm", "rt" );
+    if (fp == 0x0) return 0;
+    if (fscanf ( fp, "%ld %ld", &size, &pages ) != 2) pages = 0;
+    fclose ( fp );
+    return size_t(pages) * size_t( sysconf(_SC_PAGESIZE) );
+  #else
+    return 0;
+  #endif
+}
 
-    if (!memberOf(it->first, parent)) continue;
+int64_t getHeapUsed ()
+{
+  // bytes allocated from the heap, where the allocator reports it (glibc)
+  #if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2 ();
+    return int64_t( mi.uordblks + mi.hblkhd );
+  #else
+    return 0;
+  #endif
+}
 
-    if (lev == outlev) {
-      // print ip info
-      f = &it->second;
+double getCPUTime ()
+{
+  // cpu time of the process, all threads, secs
+  #ifdef _WIN32
+    FILETIME create, fexit, kern, user;
+    if (!GetProcessTimes ( GetCurrentProcess(), &create, &fexit, &kern, &user )) return 0;
+    uint64_t k = (uint64_t(kern.dwHighDateTime) << 32) | kern.dwLowDateTime;
+    uint64_t u = (uint64_t(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return double(k + u) * 1e-7;
+  #else
+    struct rusage ru;
+    getrusage ( RUSAGE_SELF, &ru );
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+  #endif
+}
 
-      #ifdef BUILD_OPENSSL
-        LookupName ( &f );
-      #endif
+static const char* step_names[STEP_MAX] = { "match", "merge", "sort", "days" };
+static const bool  step_traced[STEP_MAX] = { true, true, true, false };
 
-      Vec4F ipv = ipToVec( it->first );
-      Vec4F ipp = ipToVec( parent );
-      if (ipv.x==92 && ipv.y==28 && ipv.z==82 && ipv.w==214) {
-      bool stop=true;
-    }
-      const std::string& ipstr = ipToStr(it->first);			
-      const char* pagename = "";
-      if (lev == 3 && !f->pages.empty()) { pagename = f->pages[0].page.c_str(); }
+Profiler::Profiler ()
+{
+  m_t0 = std::chrono::steady_clock::now();
+  m_steps = false;
+  m_trace = false;
+  ThreadID ();                          // main thread is 0
+  m_start = m_cpu = 0;
+  m_rss = 0;
+  m_heap = 0;
+  for (int k = 0; k < STEP_MAX; k++) m_step_ns[k] = m_step_calls[k] = m_step_items[k] = 0;
+}
 
-      float day_freq = f->visit_freq / f->elapsed;			// # secs/day
-      float uniq_ratio = (f->page_cnt > 0) ? ((float)f->uniq_cnt / f->page_cnt) : 0.0f;
+double Profiler::Now ()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now() - m_t0 ).count();
+}
 
-      snprintf(m_buf, 2048, "%s, %d, %d, %d, %.2f, %.2f, %d, %d, %f, %f, %f, %f, %f, %f, %s, %s, %s, %s\n",
-        ipstr.c_str(), f->ip_cnt, f->page_cnt, f->uniq_cnt,
-        uniq_ratio, f->elapsed,
-        f->max_consecutive, f->num_robots,
-        f->daily_min_hit, f->daily_min_range/60.0, f->daily_min_ppm, f->daily_max_hit, f->daily_max_range/60.0, f->daily_max_ppm,
-        f->lookup[L_ORG].c_str(), f->lookup[L_REGION].c_str(), f->lookup[L_COUNTRY].c_str(), pagename );
-            
-      if (fp) fwrite(m_buf, 1, strlen(m_buf), fp);
+int Profiler::ThreadID ()
+{
+  // small ids for trace rows, main thread first
+  static std::atomic<int> next (0);
+  static thread_local int id = next++;
+  return id;
+}
 
-      cnt++;
-    
-    } else if (lev < 3) {
+void Profiler::Begin ()
+{
+  for (int k = 0; k < STEP_MAX; k++) m_step_ns[k] = m_step_calls[k] = m_step_items[k] = 0;
+  m_rss = getCurrentRSS ();
+  m_heap = getHeapUsed ();
+  m_cpu = getCPUTime ();
+  m_start = Now ();
+}
 
-      // print children
-      cnt += OutputIPs(outlev, lev + 1, it->first, fp);
-    }		
+void Profiler::End (std::string name, uint64_t items)
+{
+  StageTime st;
+  st.name = name;
+  st.start = m_start;
+  st.secs = Now() - m_start;
+  st.cpu_secs = getCPUTime() - m_cpu;
+  st.items = items;
+  st.rss_delta = int64_t( getCurrentRSS() ) - int64_t( m_rss );
+  st.heap_delta = getHeapUsed() - m_heap;
+  st.peak_rss = getPeakRSS ();
+  for (int k = 0; k < STEP_MAX; k++) {
+    st.steps[k].secs = m_step_ns[k] * 1e-9;
+    st.steps[k].calls = m_step_calls[k];
+    st.steps[k].items = m_step_items[k];
   }
+  m_stages.push_back ( st );
 
-  return cnt;
+  if (m_trace) {
+    TraceEvent ev = { name, ThreadID(), st.start, st.secs, items };
+    std::lock_guard<std::mutex> lock ( m_trace_mutex );
+    m_events.push_back ( ev );
+  }
 }
 
-int LogRip::OutputIPs (int outlev, std::string filename )
-{	
-  char fname[1024];
-  FILE* outcsv = 0x0;
+void Profiler::AddStep (int step, double start, uint64_t items)
+{
+  double now = Now ();
+  m_step_ns[step] += uint64_t( (now - start) * 1e9 );
+  m_step_calls[step]++;
+  m_step_items[step] += items;
+
+  if (m_trace && step_traced[step]) {
+    TraceEvent ev = { step_names[step], ThreadID(), start, now - start, items };
+    std::lock_guard<std::mutex> lock ( m_trace_mutex );
+    m_events.push_back ( ev );
+  }
+}
 
-  strncpy(fname, filename.c_str(), 1024);
-  outcsv = fopen( fname, "wt");
-  if (outcsv == 0x0) {
-    dbgprintf ( "ERROR: Unable to open %s for writing.\n", fname);
+void Profiler::WriteReport (std::string filename, uint64_t hits, const size_t* ips, int threads)
+{
+  // json report of all stages
+  FILE* fp = fopen ( filename.c_str(), "wt" );
+  if (fp == 0x0) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
     exit(-1);
-  }	
-  // header 	
-  if (outcsv != 0x0) {
-    fprintf(outcsv, "IP, ip_cnt, page_cnt, uniq_cnt, uniq_ratio, elapsed(days), max_consec, num_robot, min_hit, min_hr, min_ppm, max_hit, max_hr, max_ppm, org, region, country, page\n" );
   }
+  double wall = 0, cpu = 0;
+  for (size_t n = 0; n < m_stages.size(); n++) {
+    wall += m_stages[n].secs;
+    cpu += m_stages[n].cpu_secs;
+  }
+  fprintf ( fp, "{\n  \"hits\": %llu,\n", (unsigned long long) hits );
+  fprintf ( fp, "  \"ips\": { \"a\": %zu, \"b\": %zu, \"c\": %zu, \"d\": %zu },\n", ips[SUB_A], ips[SUB_B], ips[SUB_C], ips[SUB_D] );
+  fprintf ( fp, "  \"threads\": %d,\n", threads );
+  fprintf ( fp, "  \"wall_secs\": %.6f,\n  \"cpu_secs\": %.6f,\n  \"peak_rss\": %zu,\n", wall, cpu, getPeakRSS() );
+  fprintf ( fp, "  \"stages\": [\n" );
+  for (size_t n = 0; n < m_stages.size(); n++) {
+    const StageTime& st = m_stages[n];
+    fprintf ( fp, "    { \"name\": \"%s\", \"start\": %.6f, \"wall_secs\": %.6f, \"cpu_secs\": %.6f, \"items\": %llu, \"items_per_sec\": %.0f,\n",
+              st.name.c_str(), st.start, st.secs, st.cpu_secs, (unsigned long long) st.items, (st.secs > 0) ? st.items / st.secs : 0 );
+    fprintf ( fp, "      \"rss_delta\": %lld, \"heap_delta\": %lld, \"peak_rss\": %zu,\n      \"steps\": {",
+              (long long) st.rss_delta, (long long) st.heap_delta, st.peak_rss );
+    bool first = true;
+    for (int k = 0; k < STEP_MAX; k++) {
+      if (st.steps[k].calls == 0) continue;
+      fprintf ( fp, "%s \"%s\": { \"secs\": %.6f, \"calls\": %llu, \"items\": %llu }", first ? "" : ",", step_names[k],
+                st.steps[k].secs, (unsigned long long) st.steps[k].calls, (unsigned long long) st.steps[k].items );
+      first = false;
+    }
+    fprintf ( fp, " } }%s\n", (n + 1 < m_stages.size()) ? "," : "" );
+  }
+  fprintf ( fp, "  ]\n}\n" );
+  fclose ( fp );
+}
 
-  // recursive
-  int cnt = OutputIPs ( outlev, SUB_A, vecToIP(Vec4F(255,255,255,255)), outcsv );	
-
-  fclose (outcsv);
+void Profiler::WriteTrace (std::string filename)
+{
+  // chrome trace events (chrome://tracing, perfetto), times in microseconds
+  FILE* fp = fopen ( filename.c_str(), "wt" );
+  if (fp == 0x0) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }
+  std::lock_guard<std::mutex> lock ( m_trace_mutex );
+  fprintf ( fp, "{ \"traceEvents\": [\n" );
+  for (size_t n = 0; n < m_events.size(); n++) {
+    const TraceEvent& ev = m_events[n];
+    fprintf ( fp, "  { \"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.1f, \"dur\": %.1f, \"args\": { \"items\": %llu } },\n",
+              ev.name.c_str(), ev.tid, ev.start * 1e6, ev.dur * 1e6, (unsigned long long) ev.items );
+  }
+  fprintf ( fp, "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": { \"name\": \"main\" } }\n" );
+  fprintf ( fp, "] }\n" );
+  fclose ( fp );
+}
 
-  return cnt;
+void LogRip::StageBegin ()
+{
+  m_Prof.Begin ();
 }
 
-void LogRip::OutputPages (std::string filename)
+void LogRip::StageEnd (std::string name, uint64_t items)
 {
-  char fname[1024];
-  FILE* outcsv = 0x0;
+  m_Prof.End ( name, items );
+}
 
-  strncpy(fname, filename.c_str(), 1024);
-  outcsv = fopen(fname, "wt");
-  if (outcsv == 0x0) {
-    dbgprintf("ERROR: Unable to open %s for writing.\n", fname);
+void LogRip::OutputBench (std::string filename)
+{
+  // stage times, with throughput over all hits
+  FILE* fp = fopen ( filename.c_str(), "wt" );
+  if (fp == 0x0) {
+    dbgprintf ( "ERROR: Unable to open %s for writing.\n", filename.c_str() );
     exit(-1);
   }
-  // header		
-  if (outcsv != 0x0) fprintf(outcsv, "IP, pages, cnt, page\n");
+  const std::vector<StageTime>& stages = m_Prof.getStages ();
+  double hits = (double) m_Log.size(), total = 0, cpu = 0;
+  fprintf ( fp, "stage, secs, cpu_secs, hits_per_sec, peak_rss_mb\n" );
+  printf ( "\nBenchmark, %.0f hits\n", hits );
+  printf ( "  %-22s %10s %10s %14s %12s\n", "stage", "secs", "cpu", "hits/s", "peak MB" );
+  for (size_t n = 0; n < stages.size(); n++) {
+    const StageTime& st = stages[n];
+    double rate = (st.secs > 0) ? hits / st.secs : 0;
+    double mb = st.peak_rss / (1024.0 * 1024.0);
+    if (st.name != "GenerateLog") { total += st.secs; cpu += st.cpu_secs; }
+    fprintf ( fp, "%s, %f, %f, %.0f, %.1f\n", st.name.c_str(), st.secs, st.cpu_secs, rate, mb );
+    printf ( "  %-22s %10.3f %10.3f %14.0f %12.1f\n", st.name.c_str(), st.secs, st.cpu_secs, rate, mb );
+  }
+  double mb = getPeakRSS() / (1024.0 * 1024.0);
+  fprintf ( fp, "Total, %f, %f, %.0f, %.1f\n", total, cpu, (total > 0) ? hits / total : 0, mb );
+  printf ( "  %-22s %10.3f %10.3f %14.0f %12.1f\n\n", "Total", total, cpu, (total > 0) ? hits / total : 0, mb );
+  fclose ( fp );
+}
 
-  IPMap_iter it;
-  IPMap_t& list = m_IPList[SUB_D];
+// synthetic log generator, for benchmarks
+// - clients cluster into /24 subnets, drawn from a small pool of /16s
+// - crawlers sit in a few subnets and walk the pages steadily, at all hours
+// - people visit in short daytime sessions, mostly the popular pages
+#define GEN_PAGES     50000             // page GEN_PAGES is robots.txt
+
+struct GenRand {
+  GenRand(uint64_t seed)          { s = ((seed + 1) * 0x9E3779B97F4A7C15ULL) | 1; }
+  uint64_t  Next ()               { s ^= s >> 12; s ^= s << 25; s ^= s >> 27; return s * 2685821657736338717ULL; }
+  double    Unit ()               { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+  uint32_t  Below ( uint32_t n )  { return uint32_t( Unit() * n ); }
+  uint64_t  s;
+};
 
-  for (it = list.begin(); it != list.end(); it++) {
+struct GenHit {
+  uint32_t  time, client, page;
+};
 
-    IPInfo& f = it->second;
+static inline char* genStr ( char* p, const char* s )  { while (*s) *p++ = *s++; return p; }
+static inline char* gen2 ( char* p, int v )            { *p++ = char('0' + v / 10); *p++ = char('0' + v % 10); return p; }
+static inline char* genNum ( char* p, uint32_t v )
+{
+  char tmp[10];
+  int n = 0;
+  do { tmp[n++] = char('0' + v % 10); v /= 10; } while (v);
+  while (n) *p++ = tmp[--n];
+  return p;
+}
+static inline char* genTime ( char* p, uint32_t sec )
+{
+  p = gen2 ( p, sec / 3600 );       *p++ = ':';
+  p = gen2 ( p, (sec / 60) % 60 );  *p++ = ':';
+  return gen2 ( p, sec % 60 );
+}
+static inline char* genIP ( char* p, uint32_t ip )
+{
+  p = genNum ( p, ip >> 24 );         *p++ = '.';
+  p = genNum ( p, (ip >> 16) & 255 ); *p++ = '.';
+  p = genNum ( p, (ip >> 8) & 255 );  *p++ = '.';
+  return genNum ( p, ip & 255 );
+}
 
-    // sort pages by name 
-    SortPagesByName(f.pages);
+void LogRip::GenerateLog (std::string filename)
+{
+  long hits = getI(CONF_GEN_HITS);
+  int days = std::max ( 1, getI(CONF_GEN_DAYS) );
+  int num_ips = std::max ( 1, getI(CONF_GEN_IPS) );
+  int num_sub = std::max ( 1, getI(CONF_GEN_SUBNETS) );
+  float crawl = std::min ( 1.0f, std::max ( 0.0f, getF(CONF_GEN_CRAWLERS) ) );
+  bool ruby = (getStr(CONF_GEN_STYLE) == "ruby");
+  GenRand rnd ( getI(CONF_GEN_SEED) );
+
+  FILE* fp = fopen ( filename.c_str(), "wb" );
+  if (fp == 0x0) {
+    printf ( "**** ERROR: Unable to open %s for writing.\n", filename.c_str() );
+    exit(-1);
+  }
+  printf ( "Generating log: %s, %ld hits, %d ips, %d subnets, %d days (%s)\n", filename.c_str(), hits, num_ips, num_sub, days, ruby ? "ruby" : "apache" );
+
+  // subnets, /24s in a pool of /16s
+  int num_b = std::max ( 1, num_sub / 16 );
+  std::vector<uint32_t> bnet ( num_b ), cnet ( num_sub );
+  for (int b = 0; b < num_b; b++) bnet[b] = ((1 + rnd.Below(223)) << 24) | (rnd.Below(256) << 16);
+  for (int c = 0; c < num_sub; c++) cnet[c] = bnet[ rnd.Below(num_b) ] | (rnd.Below(256) << 8);
+
+  // clients. crawlers are 2% of the clients, in the first tenth of the subnets,
+  // people are skewed to the first subnets
+  int num_crawl = (crawl > 0) ? std::max ( 1, num_ips / 50 ) : 0;
+  int num_people = num_ips - num_crawl;
+  if (num_people == 0) crawl = 1;
+  int crawl_sub = std::max ( 1, num_sub / 10 );
+  std::vector<uint32_t> client ( num_ips ), next_page ( num_ips );
+  for (int n = 0; n < num_ips; n++) {
+    double u = rnd.Unit();
+    int c = (n < num_crawl) ? int(crawl_sub * u) : int(num_sub * u * u);
+    client[n] = cnet[c] | (1 + rnd.Below(254));
+    next_page[n] = rnd.Below(GEN_PAGES);
+  }
 
-    if (outcsv != 0x0) fprintf(outcsv, "%s, %d,,\n", ipToStr(it->first).c_str(), f.page_cnt);
+  static const char* months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  static const int mdays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  int yr = 2025, mo = 0, dd = 1;
+  uint32_t t0 = packDate ( yr, 1, 1 );
+
+  std::vector<GenHit> day_hits;
+  std::vector<char> buf ( 1 << 24 );
+  char* p = &buf[0];
+  char* flush = &buf[0] + buf.size() - 512;
+  char page[32];
+  long done = 0;
+
+  for (int d = 0; d < days; d++) {
+    long quota = hits * (d + 1) / days - done;
+    long q_crawl = long( quota * crawl );
+    uint32_t day = t0 + d * SEC_PER_DAY;
+    GenHit h;
+    day_hits.clear();
+
+    // crawlers, a few far busier than the rest
+    for (long k = 0; k < q_crawl; k++) {
+      h.client = uint32_t( num_crawl * rnd.Unit() * rnd.Unit() );
+      h.time = day + rnd.Below(SEC_PER_DAY);
+      h.page = (rnd.Below(200) == 0) ? GEN_PAGES : (next_page[h.client]++ % GEN_PAGES);
+      day_hits.push_back ( h );
+    }
+    // people, sessions of up to 12 pages, in daytime hours
+    for (long k = q_crawl; k < quota; ) {
+      h.client = num_crawl + uint32_t( num_people * pow ( rnd.Unit(), 3.0 ) );
+      uint32_t t;
+      do {
+        t = rnd.Below(SEC_PER_DAY);
+      } while (rnd.Unit() > 0.2 + 0.8 * pow ( sin ( 3.14159265 * t / SEC_PER_DAY ), 2.0 ));
+      int len = 1 + rnd.Below(12);
+      for (int s = 0; s < len && k < quota; s++, k++) {
+        h.time = day + std::min ( t, uint32_t(SEC_PER_DAY - 1) );
+        h.page = uint32_t( GEN_PAGES * pow ( rnd.Unit(), 4.0 ) );
+        day_hits.push_back ( h );
+        t += 2 + rnd.Below(60);
+      }
+    }
+    std::sort ( day_hits.begin(), day_hits.end(), [](const GenHit& a, const GenHit& b) { return a.time < b.time; } );
+
+    // write lines
+    for (size_t n = 0; n < day_hits.size(); n++) {
+      GenHit& g = day_hits[n];
+      uint32_t sec = g.time - day;
+      if (g.page == GEN_PAGES) strcpy ( page, "/robots.txt" );
+      else                     *genNum ( genStr ( page, "/items/" ), g.page ) = '\0';
+      if (ruby) {
+        // Jan 01 00:00:05 gen bash[1]: I, [2025-01-01T00:00:05 #1]  INFO -- : Started GET "/items/1" for 1.2.3.4 at 2025-01-01 00:00:05 +0000
+        p = genStr ( p, months[mo] ); *p++ = ' ';
+        p = gen2 ( p, dd );           *p++ = ' ';
+        p = genTime ( p, sec );
+        p = genStr ( p, " gen bash[1]: I, [" );
+        p = genNum ( p, yr ); *p++ = '-'; p = gen2 ( p, mo + 1 ); *p++ = '-'; p = gen2 ( p, dd ); *p++ = 'T';
+        p = genTime ( p, sec );
+        p = genStr ( p, " #1]  INFO -- : Started GET \"" );
+        p = genStr ( p, page );
+        p = genStr ( p, "\" for " );
+        p = genIP ( p, client[g.client] );
+        p = genStr ( p, " at " );
+        p = genNum ( p, yr ); *p++ = '-'; p = gen2 ( p, mo + 1 ); *p++ = '-'; p = gen2 ( p, dd ); *p++ = ' ';
+        p = genTime ( p, sec );
+        p = genStr ( p, " +0000\n" );
+      } else {
+        // 1.2.3.4 - - [01/Jan/2025:00:00:05 +0000] "GET /items/1 HTTP/1.1" 200 2301 "-" "Mozilla/5.0 (X11; Linux x86_64)"
+        p = genIP ( p, client[g.client] );
+        p = genStr ( p, " - - [" );
+        p = gen2 ( p, dd ); *p++ = '/';
+        p = genStr ( p, months[mo] ); *p++ = '/';
+        p = genNum ( p, yr ); *p++ = ':';
+        p = genTime ( p, sec );
+        p = genStr ( p, " +0000] \"GET " );
+        p = genStr ( p, page );
+        p = genStr ( p, " HTTP/1.1\" 200 " );
+        p = genNum ( p, 500 + (g.page * 37) % 20000 );
+        p = genStr ( p, (g.client < (uint32_t) num_crawl) ? " \"-\" \"Mozilla/5.0 (compatible; GenBot/1.0)\"\n" : " \"-\" \"Mozilla/5.0 (X11; Linux x86_64)\"\n" );
+      }
+      if (p > flush) {
+        fwrite ( &buf[0], 1, p - &buf[0], fp );
+        p = &buf[0];
+      }
+    }
+    done += quota;
 
-    // list unique pages
-    int cnt = 1;
-    for (int n = 1; n < f.pages.size(); n++) {
-      if (f.pages[n].page == f.pages[n - 1].page) {
-        cnt++;
-      } else {				
-        if (outcsv != 0x0) fprintf(outcsv, ",,%d,%s\n", cnt, f.pages[n - 1].page.c_str());
-        cnt = 1;
-      }	
+    // next date
+    int len = mdays[mo] + (mo == 1 && (yr % 4 == 0 && (yr % 100 != 0 || yr % 400 == 0)));
+    if (++dd > len) {
+      dd = 1;
+      if (++mo == 12) { mo = 0; yr++; }
     }
   }
-  fclose ( outcsv );
+  fwrite ( &buf[0], 1, p - &buf[0], fp );
+  fclose ( fp );
 }
 
+void LogRip::PrintUsage ()
+{
+  dbgprintf ( "Usage: logrip {log_file..} {config_file}\n\n");
+  dbgprintf ("  log_file = .txt or .log access logs from journalctl, or .gz/.zst compressed. several files are read as one log.\n" );
+  dbgprintf ("  conf_file = .conf, config file with format and policy.\n");
+  dbgprintf ("  with gen_hits set in the config, a synthetic log is generated and used when no log_file is given.\n\n");
+  dbgprintf ("ERROR: Must specify both log_file and config_file.\n");
+  dbgprintf ("e.g. logrip example.txt ruby.conf\n");
+  exit(-1);
+}
 
 void LogRip::on_arg(int i, std::string arg, std::string val)
 {
   if (i > 0) {
-    if (arg.find(".txt") != std::string::npos || arg.find(".log") != std::string::npos) {
-      m_log_file = arg;
+    if (arg.find(".txt") != std::string::npos || arg.find(".log") != std::string::npos ||
+        arg.find(".gz") != std::string::npos || arg.find(".zst") != std::string::npos) {
+      m_log_files.push_back ( arg );
     }
     if (arg.find(".conf") != std::string::npos) {
       m_conf_file = arg;
@@ -1639,8 +5699,10 @@ bool LogRip::init()
   addSearchPath ( ASSET_PATH );
   addSearchPath ( "." );
 
-  m_log_file = "";
+  m_log_files.clear ();
   m_conf_file = "";
+  m_base_hits = 0;
+  m_log_pos = 0;
 
   return true;
 }
@@ -1651,104 +5713,246 @@ void LogRip::display()
 {
   int cnt;
 
-  if (m_log_file.empty() || m_conf_file.empty() ) {
-    dbgprintf ( "Usage: logrip {log_file} {config_file}\n\n");
-    dbgprintf ("  log_file = .txt or .log access logs from journalctl.\n" );
-    dbgprintf ("  conf_file = .conf, config file with format and policy.\n\n");    
-    dbgprintf ("ERROR: Must specify both log_file and config_file.\n");
-    dbgprintf ("e.g. logrip example.txt ruby.conf\n");
-    exit(-1);
-  }
+  if (m_conf_file.empty()) PrintUsage ();
 
   LoadConfig( m_conf_file );
+  m_Prof.setTrace ( !getStr(CONF_TRACE).empty() );
+  m_Prof.setSteps ( !getStr(CONF_REPORT).empty() || !getStr(CONF_TRACE).empty() );     // sub-steps are only in the report and trace
 
-  std::string filename = std::string( m_log_file );
-  std::string logfile;
-  if (!getFileLocation(filename, logfile)) {
-    printf("**** ERROR: Unable to find or open %s\n", filename.c_str());
+  // subnet prefix lengths
+  int pb = getI(CONF_PREFIX_B), pc = getI(CONF_PREFIX_C);
+  if (pb < 1 || pc <= pb || pc >= 32) {
+    printf ( "**** ERROR: Subnet prefixes must be 1 <= prefix_b < prefix_c < 32.\n" );
     exit(-1);
   }
+  subnet_bits[SUB_A] = std::min ( 8, pb );
+  subnet_bits[SUB_B] = pb;
+  subnet_bits[SUB_C] = pc;
+  pb = getI(CONF_PREFIX6_B);
+  pc = getI(CONF_PREFIX6_C);
+  if (pb < 16 || pc <= pb || pc >= 64) {
+    printf ( "**** ERROR: IPv6 subnet prefixes must be 16 <= prefix6_b < prefix6_c < 64.\n" );
+    exit(-1);
+  }
+  subnet_bits6[SUB_B] = pb;
+  subnet_bits6[SUB_C] = pc;
 
-  // load log using dynamic parsing
-  LoadLog(logfile);
-
-  // construct IP hash from all page hits
-  dbgprintf("Construct IP Hash.\n");
-  ConstructIPHash();
-
-  // find start and end date range
-  dbgprintf("Preparing Days.\n");
-  PrepareDays();
-
-  // sort all IPs and hits by date, compute metrics & scores
-  dbgprintf("Processing IPs.\n");
-  ProcessIPs(SUB_D);
-
-  // build Class C-subnets by aggregation
-  dbgprintf("Constructing C-Subnets.\n");
-  ConstructSubnet(SUB_D, SUB_C);
-
-  // build Class B-subnets by aggregation
-  dbgprintf("Constructing B-Subnets.\n");
-  ConstructSubnet(SUB_C, SUB_B);
+  // page sketches and rate states are only kept when used
+  for (int lev = 0; lev < SUB_MAX; lev++) {
+    m_IPList[lev].setSketch ( getB(CONF_SKETCH) );
+    m_IPList[lev].setRolling ( getB(CONF_ROLLING) );
+  }
 
-  // build Class A-subnets by aggregation
-  dbgprintf("Constructing A-Subnets.\n");
-  ConstructSubnet(SUB_B, SUB_A);
+  // offline geo database, for ASN, org and country
+  std::string geofile = getStr( CONF_GEO_DB );
+  if (!geofile.empty()) {
+    if (getFileLocation(geofile, geofile) && m_Geo.Load ( geofile )) {
+      printf ( "Geo database: %s, %d ranges.\n", geofile.c_str(), (int) m_Geo.size() );
+    } else {
+      printf ( "**** WARNING: Unable to open geo database %s. Not used.\n", geofile.c_str() );
+    }
+  }
 
-  // sort all C-subnet IPs and hits by date, compute metrics & score
-  dbgprintf("Processing IPs. C-Subnets.\n");
-  ProcessIPs(SUB_C);
+  // synthetic log, for benchmarks. it is the log when none is given
+  if (getI(CONF_GEN_HITS) > 0) {
+    StageBegin();
+    GenerateLog ( getStr(CONF_GEN_FILE) );
+    StageEnd("GenerateLog", getI(CONF_GEN_HITS));
+    if (m_log_files.empty()) m_log_files.push_back ( getStr(CONF_GEN_FILE) );
+  }
+  if (m_log_files.empty()) PrintUsage ();
 
-  // sort all B-subnet IPs and hits by date, compute metrics & score
-  dbgprintf("Processing IPs. B-Subnets.\n");
-  ProcessIPs(SUB_B);
+  std::vector<std::string> logfiles;
+  std::string logfile;
+  for (size_t f = 0; f < m_log_files.size(); f++) {
+    if (!getFileLocation(m_log_files[f], logfile)) {
+      printf("**** ERROR: Unable to find or open %s\n", m_log_files[f].c_str());
+      exit(-1);
+    }
+    logfiles.push_back ( logfile );
+  }
+  // the last log is the live one, for snapshot and follow mode
+  bool live = (LogStream::getType ( logfile ) == LOG_PLAIN);
+
+  // load the snapshot of a previous run, if any
+  std::string snapfile = getStr( CONF_SNAPSHOT );
+  if (!snapfile.empty() && (!live || logfiles.size() > 1)) {
+    printf ( "**** WARNING: Snapshot needs a single uncompressed log. Not used.\n" );
+    snapfile = "";
+  }
+  int snap = 0;
+  if (!snapfile.empty()) {
+    StageBegin();
+    snap = LoadSnapshot ( snapfile, logfile );
+    StageEnd("LoadSnapshot", m_Log.size());
+  }
+  size_t start = m_Log.size();
+
+  // load logs using dynamic parsing (only lines after the snapshot)
+  StageBegin();
+  LoadLogs(logfiles, m_log_pos, live && (!snapfile.empty() || getB(CONF_FOLLOW)));
+  StageEnd("LoadLogs", m_Log.size() - start);
+
+  if (snap == 2) {
+    // top counts are not in the snapshot, count the hits it holds
+    if ( getB(CONF_SKETCH) ) ComputeTop ( 0, start );
+
+    // IPs from the snapshot, fold in new hits
+    if (m_Log.size() > start) {
+      dbgprintf("Updating IPs.\n");
+      StageBegin();
+      UpdateHits ( start );
+      StageEnd("UpdateHits", m_Log.size() - start);
+    }
+    StageBegin();
+    ComputeBlocklist ();
+    StageEnd("ComputeBlocklist", m_IPList[SUB_D].size());
+  } else {
+    // compute metrics, scores and blocklist
+    ComputeAll();
+  }
 
-  // compute blocklist hierarchically for most compact list
-  dbgprintf("Computing Blocklist.\n");
-  ComputeBlocklist();
+  if (!snapfile.empty()) {
+    StageBegin();
+    SaveSnapshot ( snapfile, logfile );
+    StageEnd("SaveSnapshot", m_Log.size());
+  }
 
   // write out the blocklist
   dbgprintf("Writing Blocklist.\n");
+  StageBegin();
   OutputBlocklist("out_blocklist.txt");
+  StageEnd("OutputBlocklist", m_IPList[SUB_D].size());
 
-  // write B-subnet list with metrics
-  dbgprintf("Writing IPs (B-Subnets)... ");
-  cnt = OutputIPs(SUB_B, "out_ips_bnet.csv");
-  printf("%d ips.\n", cnt);
-
-  // write C-subnet list with metrics
-  dbgprintf("Writing IPs (C-Subnets)... ");
-  cnt = OutputIPs(SUB_C, "out_ips_cnet.csv");
-  printf("%d ips.\n", cnt);
+  // follow mode. keep reading the log and updating the blocklist (does not return)
+  if ( getB(CONF_FOLLOW) ) {
+    if (live) FollowLog ( logfile );
+    else printf ( "**** WARNING: Follow mode needs an uncompressed log as the last file.\n" );
+  }
 
-  // write full IP list with metrics
-  dbgprintf("Writing IPs (All Mach)... ");
-  cnt = OutputIPs(SUB_D, "out_ips.csv");
-  printf("%d ips.\n", cnt);
+  // remote lookups run while the other outputs are written
+  StartLookups ();
 
   // write list of all hits organized by IP
   dbgprintf("Writing Pages.\n");
+  StageBegin();
   OutputPages("out_pages.csv");
+  StageEnd("OutputPages", m_Log.size());
+
+  // hits by time, for the outputs below
+  StageBegin();
+  m_Store.Build ( m_Log, m_HitBlock, m_time_min, m_time_max );
+  StageEnd("BuildHitStore", m_Store.size());
 
   dbgprintf("Writing Hits.\n");
+  StageBegin();
   OutputHits("out_hits.csv");
+  StageEnd("OutputHits", m_Log.size());
 
   // create an image for visualization products  
   Vec4F res = getV4( CONF_VIS_RES );
   CreateImg( res.x, res.y );
 
+  // density pyramid, every zoom renders from its tiles
+  if ( getB(CONF_VIS_DENSITY) && getI(CONF_VIS_TILES) > 0 ) {
+    dbgprintf("Building density tiles... ");
+    StageBegin();
+    m_Pyramid.Build ( m_Store, m_Store.getFirst(), m_total_days, getI(CONF_VIS_TILES) );
+    int cnt = m_Pyramid.SaveTiles ( "out_tile_", getI(CONF_VIS_TILE_SAVE) );
+    StageEnd("DensityTiles", m_Store.size());
+    printf("%d levels, %d KB, %d tiles written.\n", m_Pyramid.getLevels(), int(m_Pyramid.getBytes() >> 10), cnt);
+    if (m_Pyramid.getLevels() < getI(CONF_VIS_TILES))
+      printf ( "**** WARNING: Density pyramid limited to %d levels (at most %d, %d MB of tiles).\n", m_Pyramid.getLevels(), VIS_LEVELS, int(VIS_TILE_MEM >> 20) );
+  }
+
   // output visualizations: orginial, blocked, post-filtered
   dbgprintf("Writing Visualizations.\n");
+  StageBegin();
   OutputVis();
+  StageEnd("OutputVis", m_Log.size());
 
   // use day-sorted hits to report stats (/w and w/o blocking)
   dbgprintf("Writing Daily Stats.\n");
+  StageBegin();
   OutputStats("out_stats.csv", "out_stats.png");
+  StageEnd("OutputStats", m_Log.size());
 
   // compute and visualize estimated server load (before & after)
   dbgprintf("Writing Loads.\n");
+  StageBegin();
   OutputLoads("");
+  StageEnd("OutputLoads", m_Log.size());
+
+  // lookup results go into the IP lists
+  StageBegin();
+  FinishLookups ();
+  StageEnd("FinishLookups");
+
+  // annotate IPs and subnets from the geo database, group IPs by ASN
+  if (m_Geo.size() > 0) {
+    StageBegin();
+    ComputeGeo ();
+    StageEnd("ComputeGeo", m_IPList[SUB_D].size());
+  }
+
+  // write B-subnet list with metrics
+  dbgprintf("Writing IPs (B-Subnets)... ");
+  StageBegin();
+  cnt = OutputIPs(SUB_B, "out_ips_bnet.csv");
+  StageEnd("OutputIPs B", cnt);
+  printf("%d ips.\n", cnt);
+
+  // write C-subnet list with metrics
+  dbgprintf("Writing IPs (C-Subnets)... ");
+  StageBegin();
+  cnt = OutputIPs(SUB_C, "out_ips_cnet.csv");
+  StageEnd("OutputIPs C", cnt);
+  printf("%d ips.\n", cnt);
+
+  // write full IP list with metrics
+  dbgprintf("Writing IPs (All Mach)... ");
+  StageBegin();
+  cnt = OutputIPs(SUB_D, "out_ips.csv");
+  StageEnd("OutputIPs D", cnt);
+  printf("%d ips.\n", cnt);
+
+  // write ASN list with metrics
+  if (m_ASNList.size() > 0) {
+    dbgprintf("Writing IPs (ASNs)... ");
+    StageBegin();
+    cnt = OutputASNs("out_ips_asn.csv");
+    StageEnd("OutputASNs", cnt);
+    printf("%d asns.\n", cnt);
+  }
+
+  // write top pages and IPs
+  if (getB(CONF_SKETCH)) {
+    dbgprintf("Writing top pages and IPs... ");
+    StageBegin();
+    cnt = OutputTop("out_top.csv");
+    StageEnd("OutputTop", cnt);
+    printf("%d pages.\n", cnt);
+  }
+
+  // write IPs flagged by the rolling rates
+  if (getB(CONF_ROLLING)) {
+    dbgprintf("Writing rolling rates... ");
+    StageBegin();
+    cnt = OutputRates("out_rates.csv");
+    StageEnd("OutputRates", cnt);
+    printf("%d flagged.\n", cnt);
+  }
+
+  // stage times, hits/s and peak memory
+  if (getB(CONF_BENCH)) OutputBench ("out_bench.csv");
+
+  // instrumentation report (json) and chrome trace
+  if (!getStr(CONF_REPORT).empty()) {
+    size_t ips[SUB_MAX];
+    for (int lev = 0; lev < SUB_MAX; lev++) ips[lev] = m_IPList[lev].size();
+    m_Prof.WriteReport ( getStr(CONF_REPORT), m_Log.size(), ips, getThreads() );
+  }
+  if (!getStr(CONF_TRACE).empty()) m_Prof.WriteTrace ( getStr(CONF_TRACE) );
 
   dbgprintf("Done.\n");
 
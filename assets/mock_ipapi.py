@@ -0,0 +1,120 @@
+# Local stand-in for the ip-api batch endpoint, for testing remote lookups.
+#
+# Answers POST /batch like ip-api.com does: a json array of addresses in,
+# a json array of results out, in the same order. Results are made up from
+# the address, so every run returns the same values. The request limit and
+# the X-Rl / X-Ttl headers follow ip-api, over-limit requests get a 429.
+#
+# usage:  python3 mock_ipapi.py [port] [requests per window] [window secs]
+#         then set 'lookup_host: http://127.0.0.1:8080' in the .conf
+#
+# Every request is printed with its batch size and the requests left.
+
+import sys
+import json
+import time
+import ipaddress
+from http.server import HTTPServer, BaseHTTPRequestHandler
+from urllib.parse import urlparse, parse_qs
+
+PORT = int(sys.argv[1]) if len(sys.argv) > 1 else 8080
+LIMIT = int(sys.argv[2]) if len(sys.argv) > 2 else 15
+WINDOW = int(sys.argv[3]) if len(sys.argv) > 3 else 60
+MAX_BATCH = 100
+
+FIELDS = [ "status", "message", "country", "regionName", "city", "zip", "lat", "lon", "isp", "org", "asname", "query" ]
+COUNTRIES = [ "United States", "Germany", "China", "Brazil", "Singapore", "Netherlands", "India", "France" ]
+CITIES = [ "Ashburn", "Frankfurt", "Beijing", "Sao Paulo", "Singapore", "Amsterdam", "Mumbai", "Paris" ]
+
+window_start = time.time()
+window_used = 0
+total_requests = 0
+total_ips = 0
+
+
+def lookup(addr):
+    # made-up result for one address, the same on every run
+    try:
+        ip = ipaddress.ip_address(addr)
+    except ValueError:
+        return { "status": "fail", "message": "invalid query", "query": addr }
+    if ip.is_private or ip.is_reserved or ip.is_loopback:
+        return { "status": "fail", "message": "private range", "query": addr }
+    n = int(ip)
+    k = n % len(COUNTRIES)
+    asn = 1000 + (n >> 16) % 60000
+    return {
+        "status": "success",
+        "country": COUNTRIES[k],
+        "regionName": "Region %d" % (n % 50),
+        "city": CITIES[k],
+        "zip": "%05d" % (n % 100000),
+        "lat": round((n % 18000) / 100.0 - 90, 4),
+        "lon": round((n % 36000) / 100.0 - 180, 4),
+        "isp": "Mock ISP %d" % asn,
+        "org": "Mock Hosting, Inc." if n % 3 == 0 else "Mock Org %d" % asn,
+        "asname": "AS%d MOCK-NET" % asn,
+        "query": addr,
+    }
+
+
+class Handler(BaseHTTPRequestHandler):
+
+    def reply(self, status, body, left, ttl):
+        data = body.encode("utf-8")
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json; charset=utf-8")
+        self.send_header("Content-Length", str(len(data)))
+        self.send_header("X-Rl", str(left))
+        self.send_header("X-Ttl", str(ttl))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_POST(self):
+        global window_start, window_used, total_requests, total_ips
+        url = urlparse(self.path)
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+        # request limit per window
+        now = time.time()
+        if now - window_start >= WINDOW:
+            window_start, window_used = now, 0
+        ttl = max(0, int(window_start + WINDOW - now))
+        if window_used >= LIMIT:
+            print("%s  429 over limit, resets in %d s" % (time.strftime("%H:%M:%S"), ttl), flush=True)
+            self.reply(429, "", 0, ttl)
+            return
+        window_used += 1
+        left = LIMIT - window_used
+
+        if url.path != "/batch":
+            self.reply(404, "", left, ttl)
+            return
+        try:
+            query = json.loads(body.decode("utf-8"))
+        except ValueError:
+            self.reply(400, json.dumps({ "status": "fail", "message": "invalid json" }), left, ttl)
+            return
+        if not isinstance(query, list) or len(query) > MAX_BATCH:
+            self.reply(422, json.dumps({ "status": "fail", "message": "batch of at most %d" % MAX_BATCH }), left, ttl)
+            return
+
+        # results, only the requested fields
+        fields = parse_qs(url.query).get("fields", [",".join(FIELDS)])[0].split(",")
+        out = []
+        for q in query:
+            addr = q.get("query", "") if isinstance(q, dict) else str(q)
+            res = lookup(addr)
+            out.append({ f: res[f] for f in fields if f in res })
+
+        total_requests += 1
+        total_ips += len(query)
+        print("%s  batch of %d, %d left, %d requests, %d ips total" % (time.strftime("%H:%M:%S"), len(query), left, total_requests, total_ips), flush=True)
+        self.reply(200, json.dumps(out), left, ttl)
+
+    def log_message(self, format, *args):
+        pass
+
+
+print("Mock ip-api on port %d, %d requests per %d s." % (PORT, LIMIT, WINDOW), flush=True)
+HTTPServer(("127.0.0.1", PORT), Handler).serve_forever()
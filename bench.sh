@@ -0,0 +1,8 @@
+
+# benchmark on synthetic logs of 1M, 10M and 100M hits
+# stage times, hits/s and peak memory go to bench_{hits}.csv
+for hits in 1000000 10000000 100000000; do
+  sed "s/^gen_hits:.*/gen_hits: $hits/" assets/bench.conf > bench_$hits.conf
+  ../build/logrip/logrip bench_$hits.conf
+  mv out_bench.csv bench_$hits.csv
+done
@@ -4,30 +4,57 @@ BLOCKLIST_FILE="blocklist.txt"
 NFT_TABLE="filter"
 NFT_CHAIN="ip_blocklist"
 NFT_SET="blocked_ips"
+NFT_SET6="blocked_ips6"
+NFT_SCRIPT="out_blocklist.nft"
+NFT_STATE="out_block_state.txt"
 
-# Step 1: Clean old table/chain (optional safety)
-sudo nft delete table inet $NFT_TABLE 2>/dev/null
+# Set updates written by logrip (block_nft) are applied as one transaction, the table stays in place
+# Once applied, the pending list (block_state) becomes the state the next update is made against
+if [ -f "$NFT_SCRIPT" ]; then
+    sudo nft add table inet $NFT_TABLE
+    sudo nft add chain inet $NFT_TABLE $NFT_CHAIN '{ type filter hook prerouting priority 0; policy accept; }'
+    sudo nft -f "$NFT_SCRIPT" || exit 1
+    if [ -f "$NFT_STATE.pending" ]; then
+        mv "$NFT_STATE.pending" "$NFT_STATE"
+    fi
+else
+    # Step 1: Clean old table/chain (optional safety)
+    sudo nft delete table inet $NFT_TABLE 2>/dev/null
 
-# Step 2: Create table and chain
-sudo nft add table inet $NFT_TABLE 2>/dev/null
-sudo nft add chain inet $NFT_TABLE $NFT_CHAIN '{ type filter hook prerouting priority 0; policy accept; }'
+    # Step 2: Create table and chain
+    sudo nft add table inet $NFT_TABLE 2>/dev/null
+    sudo nft add chain inet $NFT_TABLE $NFT_CHAIN '{ type filter hook prerouting priority 0; policy accept; }'
 
-# Step 3: Create the IP set
-sudo nft delete set inet $NFT_TABLE $NFT_SET 2>/dev/null
-sudo nft add set inet $NFT_TABLE $NFT_SET '{ type ipv4_addr; flags interval; }'
+    # Step 3: Create the IP sets (IPv4 and IPv6)
+    sudo nft delete set inet $NFT_TABLE $NFT_SET 2>/dev/null
+    sudo nft add set inet $NFT_TABLE $NFT_SET '{ type ipv4_addr; flags interval; }'
+    sudo nft delete set inet $NFT_TABLE $NFT_SET6 2>/dev/null
+    sudo nft add set inet $NFT_TABLE $NFT_SET6 '{ type ipv6_addr; flags interval; }'
 
-# Step 4: Filter and format the IPs
-IP_LIST=$(grep -vE '^\s*#|^\s*$' "$BLOCKLIST_FILE" | sed 's/^[[:space:]]*//;s/[[:space:]]*$//' | paste -sd, -)
+    # Step 4: Filter and format the IPs, IPv6 entries contain ':'
+    ENTRIES=$(grep -vE '^\s*#|^\s*$' "$BLOCKLIST_FILE" | sed 's/^[[:space:]]*//;s/[[:space:]]*$//')
+    IP_LIST=$(echo "$ENTRIES" | grep -v ':' | paste -sd, -)
+    IP6_LIST=$(echo "$ENTRIES" | grep ':' | paste -sd, -)
 
-echo "Entries: { $IP_LIST }"
+    echo "Entries: { $IP_LIST }"
+    echo "IPv6 entries: { $IP6_LIST }"
 
-# Step 5: Insert IPs into the nft set (quoted properly)
-sudo nft add element inet $NFT_TABLE $NFT_SET "{ $IP_LIST }"
+    # Step 5: Insert IPs into the nft sets (quoted properly)
+    if [ -n "$IP_LIST" ]; then
+        sudo nft add element inet $NFT_TABLE $NFT_SET "{ $IP_LIST }"
+    fi
+    if [ -n "$IP6_LIST" ]; then
+        sudo nft add element inet $NFT_TABLE $NFT_SET6 "{ $IP6_LIST }"
+    fi
+fi
 
-# Step 6: Add drop rule if not already present
-if ! sudo nft list chain inet $NFT_TABLE $NFT_CHAIN | grep -q "@$NFT_SET"; then
+# Step 6: Add drop rules if not already present
+if ! sudo nft list chain inet $NFT_TABLE $NFT_CHAIN | grep -q "@$NFT_SET "; then
     sudo nft insert rule inet $NFT_TABLE $NFT_CHAIN ip saddr @$NFT_SET log flags ip options prefix \"LOGRIP=\" drop
 fi
+if ! sudo nft list chain inet $NFT_TABLE $NFT_CHAIN | grep -q "@$NFT_SET6 "; then
+    sudo nft insert rule inet $NFT_TABLE $NFT_CHAIN ip6 saddr @$NFT_SET6 log prefix \"LOGRIP=\" drop
+fi
 
 echo ""
 echo "IP blocklist applied successfully."